@@ -3,9 +3,280 @@
 #include <algorithm>
 #include <limits>
 #include <map>
+#include <array>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+#include <cmath>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <cstring>
+#include <charconv>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <shared_mutex>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <sched.h>
+#include <random>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
+// Categories of memory tracked by the training memory account
+enum MemoryCategory { DatasetMemory, IndexMemory, HistogramMemory, NodeMemory, NumMemoryCategories };
+
+// Structure to account for the bytes held by the training data structures, against an optional limit.
+// Blocks spilled to disk are counted apart, since the kernel can page them out.
+struct MemoryAccount {
+    atomic<long> current[NumMemoryCategories];
+    atomic<long> total;
+    atomic<long> peak;
+    atomic<long> spilled;
+    atomic<long> peakSpilled;
+    atomic<int> mappedBlocks;
+    long limit;           // In bytes, 0 means unlimited
+    bool spillToDisk;     // Back every large dataset block with a temporary file, not only those past the limit
+    bool hugePages;       // Back large dataset blocks with transparent huge pages
+    bool interleaveNodes; // Spread the pages of large dataset blocks round-robin over the NUMA nodes
+};
+
+MemoryAccount memoryAccount; // Zero-initialized: nothing held, no limit
+
+// Blocks of at least this size are spilled to disk when spilling is enabled
+const size_t spillThreshold = 64 << 10;
+
+// Size and alignment of a transparent huge page
+const size_t hugePageSize = 2 << 20;
+
+// Linux memory policy for mbind, from <linux/mempolicy.h>
+const int memoryPolicyInterleave = 3;
+
+// Structure to describe a block allocated with mmap rather than operator new
+struct MappedBlock {
+    void* mapping; // Start of the whole mapping, which may begin before the aligned block
+    size_t length; // Length of the whole mapping
+    bool spilled;  // Backed by a temporary file
+};
+
+mutex mappedBlocksMutex;
+map<void*, MappedBlock> mappedBlocks;
+
+// Function to remember a block allocated with mmap, so that deallocation can find it
+void registerMappedBlock(void* block, void* mapping, size_t length, bool spilled) {
+    lock_guard<mutex> lock(mappedBlocksMutex);
+    mappedBlocks[block] = {mapping, length, spilled};
+    memoryAccount.mappedBlocks++;
+}
+
+// Function to record bytes allocated (positive) or released (negative) in a category
+void trackAllocation(MemoryCategory category, long bytes) {
+    memoryAccount.current[category] += bytes;
+    long total = memoryAccount.total += bytes;
+    long peak = memoryAccount.peak;
+    while (total > peak && !memoryAccount.peak.compare_exchange_weak(peak, total)) {}
+}
+
+// Function to check whether the given number of additional bytes stays within the memory limit
+bool fitsInMemory(long bytes) {
+    return memoryAccount.limit == 0 || memoryAccount.total + bytes <= memoryAccount.limit;
+}
+
+// Function to allocate a block backed by an unlinked temporary file, so the kernel can write it out
+// under memory pressure instead of the job being killed. Returns nullptr if no file can be created.
+void* allocateSpilled(size_t bytes) {
+    const char* directory = getenv("TMPDIR");
+    string path = string(directory ? directory : "/tmp") + "/cart-spill-XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd == -1) return nullptr;
+    unlink(path.c_str());
+    void* block = MAP_FAILED;
+    if (ftruncate(fd, bytes) == 0) {
+        block = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (block == MAP_FAILED) return nullptr;
+
+    registerMappedBlock(block, block, bytes, true);
+    return block;
+}
+
+// Function to allocate a block of anonymous memory aligned to a huge page, advised for transparent huge pages
+// and/or interleaved over the given NUMA nodes (bit mask). Returns nullptr if the mapping fails.
+void* allocateLargePages(size_t bytes, bool hugePages, unsigned long interleaveMask) {
+    size_t length = bytes + hugePageSize;
+    void* mapping = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) return nullptr;
+    void* block = reinterpret_cast<void*>((reinterpret_cast<uintptr_t>(mapping) + hugePageSize - 1) & ~(hugePageSize - 1));
+    size_t alignedBytes = (bytes + hugePageSize - 1) & ~(hugePageSize - 1);
+
+    if (hugePages) madvise(block, alignedBytes, MADV_HUGEPAGE);
+    if (interleaveMask != 0) {
+        syscall(SYS_mbind, block, alignedBytes, memoryPolicyInterleave, &interleaveMask, sizeof(interleaveMask) * 8, 0);
+    }
+    registerMappedBlock(block, mapping, length, false);
+    return block;
+}
+
+// Function to release a block if it was allocated with mmap; returns false for ordinary blocks.
+// spilled tells whether the block was backed by a temporary file.
+bool releaseMapped(void* block, bool& spilled) {
+    if (memoryAccount.mappedBlocks == 0) return false;
+    lock_guard<mutex> lock(mappedBlocksMutex);
+    auto it = mappedBlocks.find(block);
+    if (it == mappedBlocks.end()) return false;
+    spilled = it->second.spilled;
+    munmap(it->second.mapping, it->second.length);
+    if (spilled) memoryAccount.spilled -= it->second.length;
+    mappedBlocks.erase(it);
+    memoryAccount.mappedBlocks--;
+    return true;
+}
+
+// Function to tell whether a block is backed by a temporary file, and so not counted against the memory limit
+bool isSpilledBlock(const void* block) {
+    if (memoryAccount.mappedBlocks == 0) return false;
+    lock_guard<mutex> lock(mappedBlocksMutex);
+    auto it = mappedBlocks.find(const_cast<void*>(block));
+    return it != mappedBlocks.end() && it->second.spilled;
+}
+
+// Function to drop the whole pages of [begin, end) of a block spilled to disk from memory and from its file, once
+// they are no longer needed; they read back as zeros. Blocks held in memory are left alone.
+void discardSpilledPages(const void* block, const void* begin, const void* end) {
+    if (!isSpilledBlock(block)) return;
+    uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    uintptr_t first = (reinterpret_cast<uintptr_t>(begin) + pageSize - 1) & ~(pageSize - 1);
+    uintptr_t last = reinterpret_cast<uintptr_t>(end) & ~(pageSize - 1);
+    if (first >= last) return;
+    if (madvise(reinterpret_cast<void*>(first), last - first, MADV_REMOVE) != 0) {
+        madvise(reinterpret_cast<void*>(first), last - first, MADV_DONTNEED); // File systems without hole punching
+    }
+}
+
+// Function to parse a Linux CPU list such as "0-3,8-11"
+vector<int> parseCpuList(const string& text) {
+    vector<int> cpus;
+    size_t position = 0;
+    while (position < text.size()) {
+        size_t comma = text.find(',', position);
+        if (comma == string::npos) comma = text.size();
+        string range = text.substr(position, comma - position);
+        size_t dash = range.find('-');
+        int first = atoi(range.c_str());
+        int last = dash == string::npos ? first : atoi(range.c_str() + dash + 1);
+        for (int cpu = first; cpu <= last && !range.empty(); ++cpu) cpus.push_back(cpu);
+        position = comma + 1;
+    }
+    return cpus;
+}
+
+// Function to read the CPUs of every NUMA node from sysfs; without NUMA information the machine is one node
+vector<vector<int>> readNumaTopology() {
+    vector<vector<int>> nodes;
+    for (int node = 0; node < 64; ++node) {
+        ifstream cpuList("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+        string text;
+        if (!cpuList || !getline(cpuList, text)) break;
+        nodes.push_back(parseCpuList(text));
+    }
+    if (nodes.empty()) {
+        nodes.emplace_back();
+        for (unsigned cpu = 0; cpu < max(1u, thread::hardware_concurrency()); ++cpu) nodes[0].push_back(cpu);
+    }
+    return nodes;
+}
+
+// Allocator that counts its blocks in the memory account, and spills large dataset blocks to disk when enabled
+template <typename T, MemoryCategory Category>
+struct TrackedAllocator {
+    typedef T value_type;
+
+    TrackedAllocator() {}
+    template <typename U>
+    TrackedAllocator(const TrackedAllocator<U, Category>&) {}
+
+    template <typename U>
+    struct rebind {
+        typedef TrackedAllocator<U, Category> other;
+    };
+
+    T* allocate(size_t count) {
+        size_t bytes = count * sizeof(T);
+        if (Category == DatasetMemory && (memoryAccount.spillToDisk || !fitsInMemory(bytes)) && bytes >= spillThreshold) {
+            if (void* block = allocateSpilled(bytes)) {
+                long spilled = memoryAccount.spilled += bytes;
+                long peak = memoryAccount.peakSpilled;
+                while (spilled > peak && !memoryAccount.peakSpilled.compare_exchange_weak(peak, spilled)) {}
+                return static_cast<T*>(block);
+            }
+        }
+        trackAllocation(Category, bytes);
+        if (Category == DatasetMemory && (memoryAccount.hugePages || memoryAccount.interleaveNodes) && bytes >= hugePageSize) {
+            unsigned long interleaveMask = 0;
+            if (memoryAccount.interleaveNodes) {
+                int numNodes = readNumaTopology().size();
+                interleaveMask = numNodes >= 64 ? ~0UL : (1UL << numNodes) - 1;
+            }
+            if (void* block = allocateLargePages(bytes, memoryAccount.hugePages, interleaveMask)) {
+                return static_cast<T*>(block);
+            }
+        }
+        return static_cast<T*>(::operator new(bytes));
+    }
+
+    void deallocate(T* block, size_t count) {
+        bool spilled = false;
+        bool mapped = releaseMapped(block, spilled);
+        if (!spilled) trackAllocation(Category, -static_cast<long>(count * sizeof(T)));
+        if (!mapped) ::operator delete(block);
+    }
+
+    // Dataset elements are left uninitialized on construction, so that their pages are first touched,
+    // and therefore placed, by the worker that fills them
+    template <typename U>
+    void construct(U* element) {
+        if (Category == DatasetMemory) {
+            ::new (static_cast<void*>(element)) U;
+        } else {
+            ::new (static_cast<void*>(element)) U();
+        }
+    }
+    template <typename U, typename... Arguments>
+    void construct(U* element, Arguments&&... arguments) {
+        ::new (static_cast<void*>(element)) U(forward<Arguments>(arguments)...);
+    }
+
+    template <typename U>
+    bool operator==(const TrackedAllocator<U, Category>&) const { return true; }
+    template <typename U>
+    bool operator!=(const TrackedAllocator<U, Category>&) const { return false; }
+};
+
+template <typename T> using DatasetVector = vector<T, TrackedAllocator<T, DatasetMemory>>;
+template <typename T> using IndexVector = vector<T, TrackedAllocator<T, IndexMemory>>;
+template <typename T> using HistogramVector = vector<T, TrackedAllocator<T, HistogramMemory>>;
+
+// Function to read the peak resident set size of the process from /proc, in bytes (0 if unavailable)
+long peakResidentBytes() {
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) return atol(line.c_str() + 6) * 1024;
+    }
+    return 0;
+}
+
 // Structure to represent a node in the decision tree
 struct Node {
     int featureIndex;
@@ -21,15 +292,25 @@ struct Node {
     // Constructor for leaf nodes
     Node(double classLabel)
         : featureIndex(-1), splitValue(-1.0), classLabel(classLabel), left(nullptr), right(nullptr) {}
+
+    // Nodes are counted in the training memory account
+    static void* operator new(size_t bytes) {
+        trackAllocation(NodeMemory, bytes);
+        return ::operator new(bytes);
+    }
+    static void operator delete(void* node, size_t bytes) {
+        trackAllocation(NodeMemory, -static_cast<long>(bytes));
+        ::operator delete(node);
+    }
 };
 
 // Function to calculate Gini impurity
 double calculateGini(const vector<double>& labels) {
-    int size = labels.size();
+    long size = labels.size();
     if (size == 0) return 0.0;
 
     // Count the occurrences of each class
-    vector<int> classCounts(2, 0);
+    vector<long> classCounts(2, 0);
     for (double label : labels) {
         int classIndex = static_cast<int>(label);
         classCounts[classIndex]++;
@@ -37,7 +318,7 @@ double calculateGini(const vector<double>& labels) {
 
     // Calculate Gini impurity
     double gini = 1.0;
-    for (int count : classCounts) {
+    for (long count : classCounts) {
         double probability = static_cast<double>(count) / size;
         gini -= probability * probability;
     }
@@ -61,7 +342,7 @@ pair<vector<vector<double>>, vector<vector<double>>> splitDataset(const vector<v
 // Function to find the best split for a given dataset and features
 pair<int, double> findBestSplit(const vector<vector<double>>& dataset, const vector<int>& features) {
     int numFeatures = features.size();
-    int numDataPoints = dataset.size();
+    long numDataPoints = dataset.size();
     double bestGini = numeric_limits<double>::infinity();
     int bestFeatureIndex = -1;
     double bestSplitValue = 0.0;
@@ -76,7 +357,7 @@ pair<int, double> findBestSplit(const vector<vector<double>>& dataset, const vec
             });
 
         // Iterate over possible split values
-        for (int i = 1; i < numDataPoints; ++i) {
+        for (long i = 1; i < numDataPoints; ++i) {
             double splitValue = (sortedDataset[i - 1][featureIndex] + sortedDataset[i][featureIndex]) / 2.0;
 
             // Split the dataset
@@ -138,12 +419,12 @@ Node* buildTree(const vector<vector<double>>& dataset, const vector<int>& featur
 
     // If no features are left, create a leaf node with the majority class label
     if (features.empty()) {
-        std::map<double, int> labelCounts; // Use std::map if not using namespace std
+        std::map<double, long> labelCounts; // Use std::map if not using namespace std
         for (const auto& dataPoint : dataset) {
             labelCounts[dataPoint.back()]++;
         }
         int majorityClass = max_element(labelCounts.begin(), labelCounts.end(), 
-                                        [](const pair<double, int>& a, const pair<double, int>& b) {
+                                        [](const pair<double, long>& a, const pair<double, long>& b) {
                                             return a.second < b.second; 
                                         })->first;
         return new Node(majorityClass);
@@ -167,33 +448,4215 @@ Node* buildTree(const vector<vector<double>>& dataset, const vector<int>& featur
     return new Node(bestFeatureIndex, bestSplitValue, leftChild, rightChild);
 }
 
-int main() {
-    // Prompt the user for the number of data points and features
-    int numDataPoints, numFeatures;
-    cout << "Enter the number of data points: ";
-    cin >> numDataPoints;
-    cout << "Enter the number of features: ";
-    cin >> numFeatures;
+// Structure to own a read-only memory mapping of a whole file, unmapped when destroyed
+struct FileMapping {
+    const char* data = nullptr;
+    size_t length = 0;
 
-    // Prompt the user for the dataset
-    vector<vector<double>> dataset(numDataPoints, vector<double>(numFeatures + 1, 0.0)); // +1 for the class label
-    cout << "Enter the dataset (each row should contain features followed by the class label):" << endl;
-    for (int i = 0; i < numDataPoints; ++i) {
-        cout << "Data point " << i + 1 << ": ";
-        for (int j = 0; j < numFeatures + 1; ++j) {
-            cin >> dataset[i][j];
+    FileMapping() = default;
+    FileMapping(FileMapping&& other) noexcept { swap(other); }
+    FileMapping& operator=(FileMapping&& other) noexcept { swap(other); return *this; }
+    ~FileMapping() { if (data != nullptr) munmap(const_cast<char*>(data), length); }
+    void swap(FileMapping& other) { std::swap(data, other.data); std::swap(length, other.length); }
+};
+
+// Function to map a file read-only; returns false if it cannot be opened or mapped
+bool mapFile(const string& path, FileMapping& mapping) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) return false;
+    struct stat status;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &status) == 0 && status.st_size > 0) {
+        data = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) return false;
+    mapping = FileMapping();
+    mapping.data = static_cast<const char*>(data);
+    mapping.length = status.st_size;
+    return true;
+}
+
+// Structure to hold a sparse matrix in compressed sparse column (CSC) or compressed sparse row (CSR) form.
+// Only the stored values are kept; all other entries are zero.
+struct SparseMatrix {
+    long numRows = 0;
+    int numColumns = 0;
+    bool columnMajor = false;     // CSC if true, CSR otherwise
+    DatasetVector<long> offsets;  // Start of every column (CSC) or row (CSR) in indices and values, plus the end
+    DatasetVector<long> indices;  // Row (CSC) or column (CSR) of every stored value, ascending within each line
+    DatasetVector<double> values;
+};
+
+// Structure to hold the bin boundaries of quantized features. A value v falls in bin upper_bound(boundaries, v),
+// so v < boundaries[b] exactly when v falls in bin b or below.
+struct BinMapper {
+    vector<vector<double>> boundaries; // boundaries[featureIndex], at most maxBins - 1 of them
+    int maxBins = 256;
+};
+
+// Structure to hold the dataset column by column, with integer class labels.
+// Columns are either owned by the store or borrowed from an external buffer (such as an Arrow batch), which must
+// outlive the store. Stores are moved, never copied, since the column pointers may point into their own storage.
+struct ColumnStore {
+    vector<const double*> columns;              // columns[featureIndex][row]
+    vector<DatasetVector<double>> ownedColumns; // Storage of the columns that are not borrowed
+    vector<FileMapping> mappings;               // Mapped files that borrowed columns point into
+    SparseMatrix sparseColumns;                 // CSC features of a sparse dataset, which has no dense columns
+    BinMapper binMapper;                        // Bin boundaries of a dataset quantized while it was loaded
+    vector<DatasetVector<uint8_t>> binnedColumns; // binnedColumns[featureIndex][row] of such a dataset, which has no dense columns
+    DatasetVector<int> labels;                  // Empty for scoring input
+    long numRows = 0;
+    int numClasses = 2;
+
+    ColumnStore() = default;
+    ColumnStore(ColumnStore&&) = default;
+    ColumnStore& operator=(ColumnStore&&) = default;
+    ColumnStore(const ColumnStore&) = delete;
+
+    bool isSparse() const { return sparseColumns.columnMajor; }
+    bool isBinned() const { return !binnedColumns.empty(); }
+    int numFeatures() const { return isSparse() ? sparseColumns.numColumns : isBinned() ? binnedColumns.size() : columns.size(); }
+};
+
+// Structure to hold the options of the presorted training engine
+struct TrainingOptions {
+    // Also drop features whose best split does not lower a node's impurity from its subtree.
+    // Off by default: a feature without gain at a node can still separate classes deeper down (e.g. XOR).
+    bool dropZeroGainFeatures = false;
+
+    // Compare split candidates with exact integer arithmetic, which is deterministic on ties across compilers and CPUs.
+    // When false, the vectorized floating-point Gini kernel is used instead.
+    bool exactScoring = true;
+
+    // Number of worker threads scanning and partitioning the columns of large nodes
+    int numThreads = 1;
+
+    // Train on at most this many bins per feature (2 to 256) with the histogram engine.
+    // 0 uses the exact presorted engine, unless it does not fit in the memory limit.
+    int maxBins = 0;
+
+    // Bytes the training data structures may hold (0 for no limit). Near the limit, training switches to
+    // the histogram engine, uses fewer bins, caches fewer histograms, and finally spills the dataset to disk.
+    long memoryLimit = 0;
+
+    // Back large column blocks with transparent huge pages
+    bool hugePages = false;
+
+    // Placement of the column data over NUMA nodes. Interleave spreads its pages round-robin over the nodes;
+    // Partition pins the workers to nodes and gives each node a contiguous block of rows, which its own workers bin
+    // (so the pages are first touched there) and scan during histogram construction.
+    enum NumaPolicy { NumaDefault, NumaInterleave, NumaPartition } numaPolicy = NumaDefault;
+
+    // Compute the bin boundaries from quantile sketches keeping about this many values per level, in one pass over
+    // every column, instead of sorting the columns (0). Boundaries are exact for columns of fewer values.
+    // Under a memory limit, 0 stands for limitedSketchSize, since sorting takes an untracked copy of every column.
+    int sketchSize = 0;
+
+    // Prefetch the bins and labels of upcoming rows while building histograms over a node's scattered rows
+    bool prefetch = true;
+};
+
+// Function to convert a row-major dataset (class label last) into a column store
+ColumnStore buildColumnStore(const vector<vector<double>>& dataset) {
+    ColumnStore store;
+    long numDataPoints = dataset.size();
+    int numFeatures = numDataPoints > 0 ? static_cast<int>(dataset[0].size()) - 1 : 0;
+
+    for (int j = 0; j < numFeatures; ++j) store.ownedColumns.emplace_back(numDataPoints);
+    for (int j = 0; j < numFeatures; ++j) store.columns.push_back(store.ownedColumns[j].data());
+    store.labels.resize(numDataPoints);
+    store.numRows = numDataPoints;
+    for (long i = 0; i < numDataPoints; ++i) {
+        for (int j = 0; j < numFeatures; ++j) {
+            store.ownedColumns[j][i] = dataset[i][j];
         }
+        store.labels[i] = static_cast<int>(dataset[i].back());
+        store.numClasses = max(store.numClasses, store.labels[i] + 1);
     }
+    return store;
+}
 
-    // Prompt the user for the features available for splitting
-    vector<int> features(numFeatures);
-    cout << "Enter the features available for splitting (0-based indices): ";
-    for (int i = 0; i < numFeatures; ++i) {
-        cin >> features[i];
+// Arrow C data interface, as specified by Apache Arrow. Record batches are read through these plain C structures,
+// so no Arrow library is needed; the guard lets the definitions coexist with Arrow's own header.
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+extern "C" {
+struct ArrowSchema {
+    const char* format;
+    const char* name;
+    const char* metadata;
+    int64_t flags;
+    int64_t n_children;
+    struct ArrowSchema** children;
+    struct ArrowSchema* dictionary;
+    void (*release)(struct ArrowSchema*);
+    void* private_data;
+};
+
+struct ArrowArray {
+    int64_t length;
+    int64_t null_count;
+    int64_t offset;
+    int64_t n_buffers;
+    int64_t n_children;
+    const void** buffers;
+    struct ArrowArray** children;
+    struct ArrowArray* dictionary;
+    void (*release)(struct ArrowArray*);
+    void* private_data;
+};
+}
+
+#endif // ARROW_C_DATA_INTERFACE
+
+// Function to tell whether the values [offset, offset + length) of an Arrow array have any nulls
+bool hasArrowNulls(const ArrowArray* array, int64_t offset, long length) {
+    const uint8_t* validity = static_cast<const uint8_t*>(array->buffers[0]);
+    if (array->null_count == 0 || validity == nullptr) return false;
+    if (array->null_count > 0 && offset == array->offset && length == array->length) return true;
+    for (long i = 0; i < length; ++i) {
+        int64_t bit = offset + i;
+        if (!(validity[bit / 8] & (1 << (bit % 8)))) return true;
+    }
+    return false;
+}
+
+// Function to convert length values of type T, stride elements apart, to doubles
+template <typename T>
+void convertValues(const void* values, long length, long stride, double* target) {
+    const T* source = static_cast<const T*>(values);
+    for (long i = 0; i < length; ++i) target[i] = source[i * stride];
+}
+
+// Function to convert length numeric values, stride elements apart, to doubles. The element type is given by its
+// Arrow format character: g, f (64/32-bit floating point), l, i, s, c (64/32/16/8-bit signed), or L, I, S, C
+// (unsigned). Returns false for any other type.
+bool convertColumn(char type, const void* values, long length, long stride, double* target) {
+    switch (type) {
+        case 'g': convertValues<double>(values, length, stride, target); return true;
+        case 'f': convertValues<float>(values, length, stride, target); return true;
+        case 'l': convertValues<int64_t>(values, length, stride, target); return true;
+        case 'i': convertValues<int32_t>(values, length, stride, target); return true;
+        case 's': convertValues<int16_t>(values, length, stride, target); return true;
+        case 'c': convertValues<int8_t>(values, length, stride, target); return true;
+        case 'L': convertValues<uint64_t>(values, length, stride, target); return true;
+        case 'I': convertValues<uint32_t>(values, length, stride, target); return true;
+        case 'S': convertValues<uint16_t>(values, length, stride, target); return true;
+        case 'C': convertValues<uint8_t>(values, length, stride, target); return true;
+        default: return false;
+    }
+}
+
+// Function to turn a column of label values into the class indices of a store; returns false unless every
+// value is a non-negative integer class index
+bool importLabels(const double* values, ColumnStore& store) {
+    store.labels.resize(store.numRows);
+    for (long row = 0; row < store.numRows; ++row) {
+        if (!(values[row] >= 0 && values[row] < numeric_limits<int>::max()) || values[row] != static_cast<int>(values[row])) {
+            return false;
+        }
+        store.labels[row] = static_cast<int>(values[row]);
+        store.numClasses = max(store.numClasses, store.labels[row] + 1);
+    }
+    return true;
+}
+
+// Function to read a numeric Arrow column of the batch's length as doubles. Float64 columns are used in place;
+// integer and float32 columns are converted into storage owned by the store. Returns nullptr for a column with
+// nulls or of another type.
+const double* importArrowColumn(const ArrowSchema* schema, const ArrowArray* array, int64_t batchOffset, long length,
+                                ColumnStore& store) {
+    int64_t offset = batchOffset + array->offset;
+    const char* format = schema->format;
+    if (array->n_buffers != 2 || hasArrowNulls(array, offset, length) || format[0] == 0 || format[1] != 0) return nullptr;
+    if (format[0] == 'g') return static_cast<const double*>(array->buffers[1]) + offset;
+
+    // Width of each element type, to find the first value of the column
+    static const string types = "fcCsSiIlL";
+    static const int sizes[] = {4, 1, 1, 2, 2, 4, 4, 8, 8};
+    size_t type = types.find(format[0]);
+    if (type == string::npos) return nullptr;
+    DatasetVector<double> values(length);
+    convertColumn(format[0], static_cast<const char*>(array->buffers[1]) + offset * sizes[type], length, 1, values.data());
+    store.ownedColumns.push_back(move(values));
+    return store.ownedColumns.back().data();
+}
+
+// Function to build a column store over an Arrow record batch, exported through the C data interface as a struct
+// array with one child per column. The label column, if labelColumn >= 0, becomes the class indices and the other
+// columns are the features, in order; scoring input passes -1. The batch stays owned by the caller and must outlive
+// the store. Returns false for a batch that cannot be read: not a struct array, nulls, non-numeric columns, or
+// labels that are not class indices.
+bool importArrowBatch(const ArrowSchema* schema, const ArrowArray* batch, int labelColumn, ColumnStore& store) {
+    if (string(schema->format) != "+s" || schema->n_children != batch->n_children || labelColumn >= batch->n_children) {
+        return false;
+    }
+    long numRows = batch->length;
+    if (hasArrowNulls(batch, batch->offset, numRows)) return false;
+
+    store = ColumnStore();
+    store.numRows = numRows;
+    for (int64_t i = 0; i < batch->n_children; ++i) {
+        const double* column = importArrowColumn(schema->children[i], batch->children[i], batch->offset, numRows, store);
+        if (column == nullptr) return false;
+        if (i != labelColumn) {
+            store.columns.push_back(column);
+        } else if (!importLabels(column, store)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Structure to describe the array stored in a .npy file
+struct NpyArray {
+    char type;        // Arrow format character of the element type (see convertColumn)
+    int elementSize;
+    bool fortranOrder; // Column-major, so that every column is contiguous
+    long rows;
+    long cols;         // 1 for a one-dimensional array
+    const char* data;
+};
+
+// Function to parse the header of a .npy file in memory: a magic string, a version, and a Python dict literal
+// such as {'descr': '<f8', 'fortran_order': False, 'shape': (1000, 6), }. Only little-endian numeric arrays of one
+// or two dimensions are accepted. Returns false for anything else, or if the file is too short for the array.
+bool parseNpy(const char* file, size_t length, NpyArray& array) {
+    if (length < 10 || memcmp(file, "\x93NUMPY", 6) != 0) return false;
+    int major = static_cast<uint8_t>(file[6]);
+    size_t headerStart = major == 1 ? 10 : 12;
+    if (length < headerStart) return false;
+    size_t headerLength = static_cast<uint8_t>(file[8]) | static_cast<uint8_t>(file[9]) << 8;
+    if (major != 1) headerLength |= static_cast<size_t>(static_cast<uint8_t>(file[10])) << 16 | static_cast<size_t>(static_cast<uint8_t>(file[11])) << 24;
+    if (headerStart + headerLength > length) return false;
+    string header(file + headerStart, headerLength);
+
+    // The value of a key of the dict, from its first character on
+    auto valueOf = [&header](const string& key) -> const char* {
+        size_t position = header.find("'" + key + "'");
+        if (position == string::npos) return nullptr;
+        position = header.find(':', position);
+        if (position == string::npos) return nullptr;
+        position = header.find_first_not_of(' ', position + 1);
+        return position == string::npos ? nullptr : header.c_str() + position;
+    };
+
+    // descr: byte order, kind and size, e.g. '<f8' or '|u1'
+    static const map<string, char> types = {{"f8", 'g'}, {"f4", 'f'}, {"i8", 'l'}, {"i4", 'i'}, {"i2", 's'}, {"i1", 'c'},
+                                            {"u8", 'L'}, {"u4", 'I'}, {"u2", 'S'}, {"u1", 'C'}, {"b1", 'C'}};
+    const char* descr = valueOf("descr");
+    if (descr == nullptr || descr[0] != '\'' || (descr[1] != '<' && descr[1] != '|' && descr[1] != '=')) return false;
+    const char* descrEnd = strchr(descr + 2, '\'');
+    if (descrEnd == nullptr) return false;
+    auto type = types.find(string(descr + 2, descrEnd));
+    if (type == types.end()) return false;
+    array.type = type->second;
+    array.elementSize = atoi(descr + 3);
+
+    const char* fortranOrder = valueOf("fortran_order");
+    if (fortranOrder == nullptr) return false;
+    array.fortranOrder = strncmp(fortranOrder, "True", 4) == 0;
+
+    // shape: (rows,) or (rows, cols)
+    const char* shape = valueOf("shape");
+    if (shape == nullptr || shape[0] != '(') return false;
+    char* end = nullptr;
+    array.rows = strtol(shape + 1, &end, 10);
+    array.cols = 1;
+    while (*end == ',' || *end == ' ') ++end;
+    if (*end != ')') array.cols = strtol(end, &end, 10);
+    while (*end == ',' || *end == ' ') ++end;
+    if (*end != ')' || array.rows < 0 || array.cols < 1) return false;
+
+    array.data = file + headerStart + headerLength;
+    return static_cast<size_t>(array.data - file) + array.rows * array.cols * array.elementSize <= length;
+}
+
+// Function to find an array of a .npz archive, a zip file of .npy files. name is the array's name without the
+// .npy extension, or empty for the first array. Only stored (uncompressed) entries can be mapped, as written by
+// numpy.savez; returns nullptr and 0 if the array is missing or compressed.
+const char* findNpzEntry(const char* file, size_t length, const string& name, size_t& entryLength) {
+    auto read16 = [file](size_t position) { return static_cast<size_t>(static_cast<uint8_t>(file[position]) | static_cast<uint8_t>(file[position + 1]) << 8); };
+    auto read32 = [&read16](size_t position) { return read16(position) | read16(position + 2) << 16; };
+    auto read64 = [&read32](size_t position) { return read32(position) | read32(position + 4) << 32; };
+
+    // Walk the local file headers: signature, ..., method at 8, sizes at 18 and 22, name and extra lengths at 26 and 28
+    size_t position = 0;
+    entryLength = 0;
+    while (position + 30 <= length && read32(position) == 0x04034b50) {
+        size_t method = read16(position + 8), flags = read16(position + 6);
+        size_t compressedSize = read32(position + 18), size = read32(position + 22);
+        size_t nameLength = read16(position + 26), extraLength = read16(position + 28);
+        size_t dataStart = position + 30 + nameLength + extraLength;
+        if (dataStart > length || (flags & 8)) return nullptr; // Sizes after the data cannot be walked
+
+        // Archives over 4 GiB keep the sizes in a zip64 extra field
+        for (size_t extra = position + 30 + nameLength; extra + 4 <= dataStart; extra += 4 + read16(extra + 2)) {
+            if (read16(extra) == 1 && size == 0xFFFFFFFF && extra + 20 <= dataStart) {
+                size = read64(extra + 4);
+                compressedSize = read64(extra + 12);
+            }
+        }
+
+        string entryName(file + position + 30, nameLength);
+        if (entryName.size() > 4 && entryName.compare(entryName.size() - 4, 4, ".npy") == 0
+            && (name.empty() || entryName == name + ".npy")) {
+            if (method != 0 || dataStart + size > length) return nullptr;
+            entryLength = size;
+            return file + dataStart;
+        }
+        position = dataStart + compressedSize;
+    }
+    return nullptr;
+}
+
+// Function to load a .npy file, or an array of a .npz archive (by name, or the first one), into a column store by
+// memory-mapping it. Each row is a data point; with hasLabels the last column holds the class labels. Columns of
+// a Fortran-ordered float64 array are used in place, so even a huge file loads in constant time; the columns of
+// C-ordered or other numeric arrays are converted once. Returns false if the file cannot be mapped or parsed.
+bool loadNumpy(const string& path, bool hasLabels, ColumnStore& store, const string& arrayName = "") {
+    FileMapping mapping;
+    if (!mapFile(path, mapping)) return false;
+    const char* file = mapping.data;
+    size_t length = mapping.length;
+    if (length >= 4 && memcmp(file, "PK\x03\x04", 4) == 0) {
+        file = findNpzEntry(mapping.data, mapping.length, arrayName, length);
+        if (file == nullptr) return false;
+    }
+    NpyArray array;
+    if (!parseNpy(file, length, array) || (hasLabels && array.cols < 2)) return false;
+
+    store = ColumnStore();
+    store.numRows = array.rows;
+    int numColumns = array.cols;
+    long stride = array.fortranOrder ? 1 : array.cols;
+    auto columnStart = [&array](int j) {
+        return array.data + (array.fortranOrder ? j * array.rows : j) * array.elementSize;
+    };
+    vector<double*> converted(numColumns, nullptr);
+    bool borrowed = false;
+    for (int j = 0; j < numColumns; ++j) {
+        bool inPlace = array.fortranOrder && array.type == 'g' && reinterpret_cast<uintptr_t>(columnStart(j)) % sizeof(double) == 0;
+        if (inPlace) {
+            store.columns.push_back(reinterpret_cast<const double*>(columnStart(j)));
+            borrowed = borrowed || !(hasLabels && j == numColumns - 1);
+        } else {
+            store.ownedColumns.emplace_back(array.rows);
+            converted[j] = store.ownedColumns.back().data();
+            store.columns.push_back(converted[j]);
+        }
+    }
+
+    // Convert blocks of rows, so that a C-ordered array is read sequentially
+    const long blockRows = array.fortranOrder ? max(array.rows, 1L) : 1024;
+    for (long begin = 0; begin < array.rows; begin += blockRows) {
+        long count = min(blockRows, array.rows - begin);
+        for (int j = 0; j < numColumns; ++j) {
+            if (converted[j] == nullptr) continue;
+            convertColumn(array.type, columnStart(j) + begin * stride * array.elementSize, count, stride, converted[j] + begin);
+        }
+    }
+
+    if (hasLabels) {
+        const double* labels = store.columns.back();
+        store.columns.pop_back();
+        if (!importLabels(labels, store)) return false;
+        if (converted.back() != nullptr) store.ownedColumns.pop_back();
+    }
+    if (borrowed) {
+        store.mappings.push_back(move(mapping));
+    }
+    return true;
+}
+
+// Function to classify a row of a column store using the decision tree
+double classify(const Node* node, const ColumnStore& store, long row) {
+    while (node->featureIndex != -1) {
+        node = store.columns[node->featureIndex][row] < node->splitValue ? node->left : node->right;
+    }
+    return node->classLabel;
+}
+
+// Function to classify a row of a CSR sparse matrix using the decision tree; features not stored in the row are zero
+double classify(const Node* node, const SparseMatrix& rows, long row) {
+    const long* rowBegin = &rows.indices[rows.offsets[row]];
+    const long* rowEnd = &rows.indices[0] + rows.offsets[row + 1];
+    while (node->featureIndex != -1) {
+        const long* entry = lower_bound(rowBegin, rowEnd, static_cast<long>(node->featureIndex));
+        double value = entry != rowEnd && *entry == node->featureIndex ? rows.values[entry - &rows.indices[0]] : 0.0;
+        node = value < node->splitValue ? node->left : node->right;
+    }
+    return node->classLabel;
+}
+
+// Function to classify every row of a CSR sparse matrix
+vector<double> classifyBatch(const Node* root, const SparseMatrix& rows) {
+    vector<double> predictions(rows.numRows);
+    for (long row = 0; row < rows.numRows; ++row) {
+        predictions[row] = classify(root, rows, row);
+    }
+    return predictions;
+}
+
+// Function to classify every row of a column store
+vector<double> classifyBatch(const Node* root, const ColumnStore& store) {
+    vector<double> predictions(store.numRows);
+    for (long row = 0; row < store.numRows; ++row) {
+        predictions[row] = classify(root, store, row);
+    }
+    return predictions;
+}
+
+// Class to run parallel loops on a fixed set of worker threads; the calling thread takes part as worker 0
+class ThreadPool {
+public:
+    explicit ThreadPool(int numThreads) : numWorkers(max(1, numThreads)) {
+        for (int worker = 1; worker < numWorkers; ++worker) {
+            threads.emplace_back(&ThreadPool::workerLoop, this, worker);
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            lock_guard<mutex> lock(stateMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (thread& worker : threads) worker.join();
+        if (callerPinned) pthread_setaffinity_np(caller, sizeof(callerAffinity), &callerAffinity);
+    }
+
+    int size() const { return numWorkers; }
+
+    // Number of NUMA nodes the workers are spread over, and the node of a worker
+    int numNodes() const { return nodeCount; }
+    int nodeOfWorker(int worker) const { return worker % nodeCount; }
+
+    // Function to pin the workers to CPUs, worker w to NUMA node w % n, where n is the number of nodes that get a worker.
+    // The calling thread is pinned as worker 0 while the pool lives; its previous CPU set is restored on destruction,
+    // so that threads it creates later are not confined to one CPU.
+    void pinWorkers(const vector<vector<int>>& nodes) {
+        if (!callerPinned) {
+            caller = pthread_self();
+            callerPinned = pthread_getaffinity_np(caller, sizeof(callerAffinity), &callerAffinity) == 0;
+        }
+        nodeCount = max(1, min(static_cast<int>(nodes.size()), numWorkers));
+        forEachWorker([&](int worker) {
+            const vector<int>& cpus = nodes[nodeOfWorker(worker)];
+            if (cpus.empty()) return;
+            cpu_set_t cpuSet;
+            CPU_ZERO(&cpuSet);
+            CPU_SET(cpus[(worker / nodeCount) % cpus.size()], &cpuSet);
+            pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+        });
+    }
+
+    // Function to call function(worker) exactly once on every worker, for work that must stay on a given thread
+    template <typename Function>
+    void forEachWorker(Function&& function) {
+        eachWorkerOnce = true;
+        parallelFor(numWorkers, [&](int worker, int) { function(worker); });
+        eachWorkerOnce = false;
+    }
+
+    // Function to call function(worker, index) for every index in [0, count), spread over the workers.
+    // Returns once all indices are done; the function is not copied, so no allocation happens per call.
+    template <typename Function>
+    void parallelFor(int count, Function&& function) {
+        typedef typename remove_reference<Function>::type FunctionType;
+        if (numWorkers == 1 || count <= 1) {
+            for (int i = 0; i < count; ++i) function(0, i);
+            return;
+        }
+        {
+            lock_guard<mutex> lock(stateMutex);
+            task = [](void* context, int worker, int index) { (*static_cast<FunctionType*>(context))(worker, index); };
+            taskContext = const_cast<void*>(static_cast<const void*>(&function));
+            taskCount = count;
+            nextIndex = 0;
+            pending = numWorkers - 1;
+            generation++;
+        }
+        wake.notify_all();
+        runTask(0);
+        unique_lock<mutex> lock(stateMutex);
+        finished.wait(lock, [this] { return pending == 0; });
+    }
+
+private:
+    void runTask(int worker) {
+        if (eachWorkerOnce) {
+            task(taskContext, worker, worker);
+            return;
+        }
+        for (int index = nextIndex++; index < taskCount; index = nextIndex++) {
+            task(taskContext, worker, index);
+        }
+    }
+
+    void workerLoop(int worker) {
+        long seenGeneration = 0;
+        while (true) {
+            {
+                unique_lock<mutex> lock(stateMutex);
+                wake.wait(lock, [&] { return stopping || generation != seenGeneration; });
+                if (stopping) return;
+                seenGeneration = generation;
+            }
+            runTask(worker);
+            lock_guard<mutex> lock(stateMutex);
+            if (--pending == 0) finished.notify_one();
+        }
+    }
+
+    int numWorkers;
+    vector<thread> threads;
+    mutex stateMutex;
+    condition_variable wake, finished;
+    long generation = 0;
+    bool stopping = false;
+    int pending = 0;
+    void (*task)(void*, int, int) = nullptr;
+    void* taskContext = nullptr;
+    int taskCount = 0;
+    atomic<int> nextIndex{0};
+    bool eachWorkerOnce = false;
+    int nodeCount = 1;
+    bool callerPinned = false; // Whether pinWorkers pinned the calling thread, whose CPU set is then saved below
+    pthread_t caller;
+    cpu_set_t callerAffinity;
+};
+
+// Class to pass items between the stages of a pipeline through a queue of bounded capacity.
+// push blocks while the queue is full; pop blocks while it is empty, and returns false once it is closed and drained.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(max<size_t>(capacity, 1)) {}
+
+    void push(T item) {
+        unique_lock<mutex> lock(queueMutex);
+        notFull.wait(lock, [this] { return items.size() < capacity; });
+        items.push_back(move(item));
+        notEmpty.notify_one();
+    }
+
+    bool pop(T& item) {
+        unique_lock<mutex> lock(queueMutex);
+        notEmpty.wait(lock, [this] { return !items.empty() || closed; });
+        if (items.empty()) return false;
+        item = move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    // Function to signal that no more items will be pushed
+    void close() {
+        lock_guard<mutex> lock(queueMutex);
+        closed = true;
+        notEmpty.notify_all();
+    }
+
+private:
+    size_t capacity;
+    deque<T> items;
+    mutex queueMutex;
+    condition_variable notFull, notEmpty;
+    bool closed = false;
+};
+
+// Rows per chunk of batch inference, so that a chunk's feature values and predictions stay in its worker's L2 cache
+const long inferenceChunkRows = 4096;
+
+// Function to call function(worker, begin, end) for chunks of the rows [0, numRows), spread over the workers of a
+// pool. Chunks start on cache line boundaries of output, the per-row array they write, so that every worker writes
+// its own slice of it and no two workers share a cache line.
+template <typename Function>
+void forEachRowChunk(ThreadPool& pool, long numRows, const double* output, Function&& function) {
+    long lineRows = 64 / sizeof(double);
+    long firstAligned = (lineRows - reinterpret_cast<uintptr_t>(output) / sizeof(double) % lineRows) % lineRows;
+    long numChunks = 1 + (max(numRows - firstAligned, 0L) + inferenceChunkRows - 1) / inferenceChunkRows;
+    pool.parallelFor(numChunks, [&](int worker, int chunk) {
+        long begin = chunk == 0 ? 0 : firstAligned + (chunk - 1) * inferenceChunkRows;
+        long end = min(numRows, firstAligned + chunk * inferenceChunkRows);
+        if (begin < end) function(worker, begin, end);
+    });
+}
+
+// Rows that batch traversal moves through the tree together, so that while one row waits for its next node to
+// arrive from memory the others make progress
+const int traversalGroupRows = 16;
+
+// Function to classify the rows [begin, end) of a column store, a group of rows at a time: each pass moves every row
+// of the group down one level. With prefetch, the next node of every row is prefetched as soon as it is known,
+// and is usually in cache by the time the next pass reaches the row.
+void classifyRows(const Node* root, const ColumnStore& store, long begin, long end, double* predictions, bool prefetch) {
+    const Node* nodes[traversalGroupRows];
+    for (long groupBegin = begin; groupBegin < end; groupBegin += traversalGroupRows) {
+        int groupSize = min<long>(traversalGroupRows, end - groupBegin);
+        fill(nodes, nodes + groupSize, root);
+        for (bool moved = true; moved; ) {
+            moved = false;
+            for (int i = 0; i < groupSize; ++i) {
+                const Node* node = nodes[i];
+                if (node->featureIndex == -1) continue;
+                node = store.columns[node->featureIndex][groupBegin + i] < node->splitValue ? node->left : node->right;
+                if (prefetch) __builtin_prefetch(node);
+                nodes[i] = node;
+                moved = true;
+            }
+        }
+        for (int i = 0; i < groupSize; ++i) predictions[groupBegin + i] = nodes[i]->classLabel;
+    }
+}
+
+// Function to classify every row of a column store on the workers of a pool, prefetching nodes unless disabled
+vector<double> classifyBatch(const Node* root, const ColumnStore& store, ThreadPool& pool, bool prefetch = true) {
+    vector<double> predictions(store.numRows);
+    forEachRowChunk(pool, store.numRows, predictions.data(), [&](int, long begin, long end) {
+        classifyRows(root, store, begin, end, predictions.data(), prefetch);
+    });
+    return predictions;
+}
+
+// Structure to hold the rows parsed from one chunk of a LibSVM file, in CSR form. The blocks are dataset blocks, so
+// that they count against the memory limit and are spilled to disk past it.
+struct LibSvmChunk {
+    DatasetVector<double> labels;
+    DatasetVector<long> rowLengths;
+    DatasetVector<long> indices;
+    DatasetVector<double> values;
+    long numColumns = 0;
+    bool valid = true;
+};
+
+// Function to parse the lines of [begin, end) of a LibSVM file: "label index:value index:value ...", with 1-based
+// ascending feature indices, optional "qid:n" tokens and "#" comments. Sets chunk.valid to false on a malformed line.
+void parseLibSvmChunk(const char* begin, const char* end, LibSvmChunk& chunk) {
+    const char* position = begin;
+    auto skipBlanks = [&position, end] { while (position < end && (*position == ' ' || *position == '\t' || *position == '\r')) ++position; };
+    auto skipLine = [&position, end] { while (position < end && *position != '\n') ++position; };
+    while (position < end) {
+        skipBlanks();
+        if (position == end || *position == '\n' || *position == '#') {
+            skipLine();
+            ++position;
+            continue;
+        }
+        double label;
+        if (*position == '+') ++position; // from_chars takes no plus sign, which the +1 labels of binary datasets have
+        from_chars_result result = from_chars(position, end, label);
+        if (result.ec != errc()) {
+            chunk.valid = false;
+            return;
+        }
+        position = result.ptr;
+
+        long rowLength = 0, previousIndex = -1;
+        while (true) {
+            skipBlanks();
+            if (position == end || *position == '\n' || *position == '#') break;
+            long index;
+            double value;
+            result = from_chars(position, end, index);
+            if (result.ec != errc()) {
+                // A qid:n token, or anything else that is not a feature
+                while (position < end && *position != ' ' && *position != '\t' && *position != '\n') ++position;
+                continue;
+            }
+            position = result.ptr;
+            if (position == end || *position != ':' || index < 1 || index - 1 <= previousIndex) {
+                chunk.valid = false;
+                return;
+            }
+            result = from_chars(position + 1, end, value);
+            if (result.ec != errc()) {
+                chunk.valid = false;
+                return;
+            }
+            position = result.ptr;
+            previousIndex = index - 1;
+            chunk.indices.push_back(index - 1);
+            chunk.values.push_back(value);
+            rowLength++;
+        }
+        skipLine();
+        ++position;
+        chunk.labels.push_back(label);
+        chunk.rowLengths.push_back(rowLength);
+        chunk.numColumns = max(chunk.numColumns, previousIndex + 1);
+    }
+}
+
+// Function to call parse on consecutive slices of whole lines of [begin, end) of a mapped file, and to drop the pages
+// of every slice from memory once it is parsed; they are read from the file again if needed
+template <typename Parse>
+void forEachTextSlice(const char* begin, const char* end, Parse parse) {
+    const long sliceBytes = 8 << 20;
+    uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    while (begin < end) {
+        const char* sliceEnd = nullptr;
+        if (end - begin > sliceBytes) sliceEnd = static_cast<const char*>(memchr(begin + sliceBytes, '\n', end - begin - sliceBytes));
+        sliceEnd = sliceEnd == nullptr ? end : sliceEnd + 1;
+        parse(begin, sliceEnd);
+        uintptr_t first = reinterpret_cast<uintptr_t>(begin) & ~(pageSize - 1);
+        uintptr_t last = reinterpret_cast<uintptr_t>(sliceEnd) & ~(pageSize - 1);
+        if (first < last) madvise(reinterpret_cast<void*>(first), last - first, MADV_DONTNEED);
+        begin = sliceEnd;
+    }
+}
+
+// Function to load a LibSVM file into a sparse matrix, CSC for training or CSR for scoring, and its labels.
+// The file is mapped and cut into one chunk of whole lines per thread; the chunks are parsed in parallel into CSR
+// rows, which are then copied into place, or transposed straight into place for CSC. No dense matrix is ever built,
+// and the text is dropped from memory slice by slice as it is parsed.
+// Returns false if the file cannot be mapped or has a malformed line.
+bool loadLibSvm(const string& path, bool columnMajor, int numThreads, SparseMatrix& matrix, DatasetVector<double>& labels) {
+    FileMapping mapping;
+    if (!mapFile(path, mapping)) return false;
+    ThreadPool pool(numThreads);
+    int numChunks = pool.size();
+
+    // Cut the file after the newline closest to every even share
+    vector<const char*> cuts(numChunks + 1, mapping.data + mapping.length);
+    cuts[0] = mapping.data;
+    for (int i = 1; i < numChunks; ++i) {
+        const char* cut = mapping.data + mapping.length * i / numChunks;
+        cut = max(cut, cuts[i - 1]);
+        const char* newline = static_cast<const char*>(memchr(cut, '\n', mapping.data + mapping.length - cut));
+        cuts[i] = newline == nullptr ? mapping.data + mapping.length : newline + 1;
+    }
+    vector<LibSvmChunk> chunks(numChunks);
+    pool.forEachWorker([&](int worker) {
+        // Count the values and lines first, so that the buffers are not copied while they grow
+        long numValues = 0, numLines = 0;
+        forEachTextSlice(cuts[worker], cuts[worker + 1], [&](const char* begin, const char* end) {
+            numValues += count(begin, end, ':');
+            numLines += count(begin, end, '\n') + 1;
+        });
+        LibSvmChunk& chunk = chunks[worker];
+        chunk.indices.reserve(numValues);
+        chunk.values.reserve(numValues);
+        chunk.labels.reserve(numLines);
+        chunk.rowLengths.reserve(numLines);
+        forEachTextSlice(cuts[worker], cuts[worker + 1], [&chunk](const char* begin, const char* end) {
+            if (chunk.valid) parseLibSvmChunk(begin, end, chunk);
+        });
+    });
+    mapping = FileMapping();
+
+    // Place the rows of the chunks one after the other
+    vector<long> firstRow(numChunks + 1, 0), firstValue(numChunks + 1, 0);
+    matrix = SparseMatrix();
+    for (int i = 0; i < numChunks; ++i) {
+        if (!chunks[i].valid) return false;
+        firstRow[i + 1] = firstRow[i] + chunks[i].labels.size();
+        firstValue[i + 1] = firstValue[i] + chunks[i].values.size();
+        matrix.numColumns = max<long>(matrix.numColumns, chunks[i].numColumns);
+    }
+    long numRows = firstRow[numChunks], numValues = firstValue[numChunks];
+    matrix.numRows = numRows;
+    labels.resize(numRows);
+    if (!columnMajor) {
+        DatasetVector<long> rowOffsets(numRows + 1), columnIndices(numValues);
+        DatasetVector<double> rowValues(numValues);
+        rowOffsets[numRows] = numValues;
+        pool.forEachWorker([&](int worker) {
+            LibSvmChunk& chunk = chunks[worker];
+            long offset = firstValue[worker];
+            for (size_t row = 0; row < chunk.labels.size(); ++row) {
+                labels[firstRow[worker] + row] = chunk.labels[row];
+                rowOffsets[firstRow[worker] + row] = offset;
+                offset += chunk.rowLengths[row];
+            }
+            copy(chunk.indices.begin(), chunk.indices.end(), columnIndices.begin() + firstValue[worker]);
+            copy(chunk.values.begin(), chunk.values.end(), rowValues.begin() + firstValue[worker]);
+            chunk = LibSvmChunk();
+        });
+        matrix.offsets = move(rowOffsets);
+        matrix.indices = move(columnIndices);
+        matrix.values = move(rowValues);
+        return true;
+    }
+
+    // Transpose the chunks straight to CSC: every worker counts the values of its rows per column, and then scatters
+    // them, so that the rows of every column stay in ascending order
+    int numColumns = matrix.numColumns;
+    vector<vector<long>> columnCounts(numChunks, vector<long>(numColumns + 1, 0));
+    pool.forEachWorker([&](int worker) {
+        for (long column : chunks[worker].indices) columnCounts[worker][column]++;
+    });
+    matrix.columnMajor = true;
+    matrix.offsets.resize(numColumns + 1);
+    long total = 0;
+    for (int column = 0; column < numColumns; ++column) {
+        matrix.offsets[column] = total;
+        for (int worker = 0; worker < numChunks; ++worker) {
+            long count = columnCounts[worker][column];
+            columnCounts[worker][column] = total;
+            total += count;
+        }
+    }
+    matrix.offsets[numColumns] = total;
+    matrix.indices.resize(numValues);
+    matrix.values.resize(numValues);
+    pool.forEachWorker([&](int worker) {
+        LibSvmChunk& chunk = chunks[worker];
+        vector<long>& next = columnCounts[worker];
+        const long discardValues = 1 << 16; // Values scattered between discards of the chunk's spilled pages
+        long value = 0, discarded = 0;
+        for (size_t row = 0; row < chunk.labels.size(); ++row) {
+            labels[firstRow[worker] + row] = chunk.labels[row];
+            for (long rowEnd = value + chunk.rowLengths[row]; value < rowEnd; ++value) {
+                long target = next[chunk.indices[value]]++;
+                matrix.indices[target] = firstRow[worker] + row;
+                matrix.values[target] = chunk.values[value];
+            }
+            if (value - discarded >= discardValues) {
+                discardSpilledPages(chunk.indices.data(), chunk.indices.data(), chunk.indices.data() + value);
+                discardSpilledPages(chunk.values.data(), chunk.values.data(), chunk.values.data() + value);
+                discarded = value;
+            }
+        }
+        chunk = LibSvmChunk();
+    });
+    return true;
+}
+
+// Function to set the labels of a store from the labels of a LibSVM file. Labels must be class indices, except that
+// the -1/+1 labels of binary datasets are read as classes 0 and 1. Returns false if a label is not a class index.
+bool importLibSvmLabels(double* labels, long count, ColumnStore& store) {
+    if (all_of(labels, labels + count, [](double label) { return label == -1.0 || label == 1.0; })) {
+        for (long i = 0; i < count; ++i) labels[i] = labels[i] > 0 ? 1.0 : 0.0;
+    }
+    return importLabels(labels, store);
+}
+
+// Function to load a LibSVM file as a sparse training dataset. Returns false if the file cannot be loaded.
+bool loadLibSvm(const string& path, int numThreads, ColumnStore& store) {
+    DatasetVector<double> labels;
+    store = ColumnStore();
+    if (!loadLibSvm(path, true, numThreads, store.sparseColumns, labels)) return false;
+    store.numRows = labels.size();
+    return importLibSvmLabels(labels.data(), labels.size(), store);
+}
+
+// Function to calculate Gini impurity from class counts
+template <typename Count>
+double calculateGiniCounts(const Count* classCounts, int numClasses, long size) {
+    if (size == 0) return 0.0;
+
+    double gini = 1.0;
+    for (int c = 0; c < numClasses; ++c) {
+        double probability = static_cast<double>(classCounts[c]) / size;
+        gini -= probability * probability;
+    }
+    return gini;
+}
+
+// Structure to hold the class statistics of a node, handed down from its parent's split.
+// Count is the type of the class counts: int in the presorted engine, long in the histogram engine.
+template <typename Count>
+struct NodeStats {
+    const Count* classCounts;
+    int numClasses;
+    long size;
+    double gini;
+};
+
+// Structure to represent the best split found for a node
+struct SplitResult {
+    int featureIndex; // -1 if no split candidate exists
+    double splitValue;
+};
+
+// Function to compute the statistics of a node from its class counts
+template <typename Count>
+NodeStats<Count> makeNodeStats(const Count* classCounts, int numClasses) {
+    NodeStats<Count> stats;
+    stats.classCounts = classCounts;
+    stats.numClasses = numClasses;
+    stats.size = 0;
+    for (int c = 0; c < numClasses; ++c) stats.size += classCounts[c];
+    stats.gini = calculateGiniCounts(classCounts, numClasses, stats.size);
+    return stats;
+}
+
+// Structure to hold the scratch buffers of one worker, sized once from the dataset dimensions and reused at every node.
+// The buffers of the floating-point scan are only sized with floatScoring, since exact scoring never touches them.
+template <typename Count>
+struct ScratchArena {
+    IndexVector<Count> transposed; // One class of a column's run counts (floating-point scan)
+    IndexVector<Count> prefix;     // Per-class prefix sums of the run counts (floating-point scan)
+    IndexVector<double> scores;    // Score of every candidate threshold (floating-point scan)
+    IndexVector<Count> running;    // Running left class counts of the exact scan
+    IndexVector<int> leftRows;     // Partition output of the presorted engine, with room for the SIMD overshoot
+    IndexVector<int> rightRows;
+
+    ScratchArena(int numDataPoints, int numClasses, bool floatScoring)
+        : transposed(floatScoring ? numDataPoints : 0), prefix(floatScoring ? static_cast<size_t>(numClasses) * numDataPoints : 0),
+          scores(floatScoring ? numDataPoints : 0),
+          running(numClasses), leftRows(numDataPoints + 16), rightRows(numDataPoints + 16) {}
+};
+
+// Function to compute the inclusive prefix sums of an array of counts
+template <typename Count>
+void prefixSums(const Count* counts, int count, Count* sums) {
+    int i = 0;
+    Count carry = 0;
+#if defined(__AVX2__)
+    // 8 counts at a time: shift-and-add within each 128-bit lane, then carry the low lane into the high one.
+    // Only 32-bit counts take the vector path.
+    if constexpr (sizeof(Count) == sizeof(int)) {
+        __m256i carryVector = _mm256_setzero_si256();
+        for (; i + 8 <= count; i += 8) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(counts + i));
+            x = _mm256_add_epi32(x, _mm256_slli_si256(x, 4));
+            x = _mm256_add_epi32(x, _mm256_slli_si256(x, 8));
+            __m256i laneTotals = _mm256_shuffle_epi32(x, 0xFF);
+            x = _mm256_add_epi32(x, _mm256_permute2x128_si256(laneTotals, laneTotals, 0x08));
+            x = _mm256_add_epi32(x, carryVector);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(sums + i), x);
+            carryVector = _mm256_permutevar8x32_epi32(x, _mm256_set1_epi32(7));
+        }
+        carry = _mm256_cvtsi256_si32(carryVector);
+    }
+#endif
+    for (; i < count; ++i) {
+        carry += counts[i];
+        sums[i] = carry;
+    }
+}
+
+// Function to evaluate the weighted Gini impurity of every threshold between consecutive runs in one vectorized pass.
+// The class counts of the runs are transposed, prefix-summed per class, and then scored several candidates per instruction.
+// The vector paths load 32-bit counts; 64-bit counts are scored by the scalar loop.
+// Returns the run r whose boundary with run r - 1 scores lowest (the first one on ties), or -1 if the column has one run.
+template <typename Count>
+int findBestRunBoundary(const Count* runClassCounts, int numRuns, const NodeStats<Count>& stats, ScratchArena<Count>& arena,
+                        double& bestGini, Count* leftCounts) {
+    int numClasses = stats.numClasses;
+    int numCandidates = numRuns - 1;
+    if (numCandidates <= 0) return -1;
+
+    // left[c * numCandidates + k] is the number of rows of class c in runs 0..k
+    Count* transposed = arena.transposed.data();
+    Count* left = arena.prefix.data();
+    double* scores = arena.scores.data();
+    for (int c = 0; c < numClasses; ++c) {
+        for (int k = 0; k < numCandidates; ++k) {
+            transposed[k] = runClassCounts[k * numClasses + c];
+        }
+        prefixSums(transposed, numCandidates, &left[c * numCandidates]);
+    }
+
+    double total = stats.size;
+    int k = 0;
+#if defined(__AVX512F__)
+    if constexpr (sizeof(Count) == sizeof(int)) {
+        __m512d one = _mm512_set1_pd(1.0), totalVector = _mm512_set1_pd(total);
+        for (; k + 8 <= numCandidates; k += 8) {
+            __m512d leftSize = _mm512_setzero_pd();
+            for (int c = 0; c < numClasses; ++c) {
+                leftSize = _mm512_add_pd(leftSize, _mm512_cvtepi32_pd(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(&left[c * numCandidates + k]))));
+            }
+            __m512d rightSize = _mm512_sub_pd(totalVector, leftSize);
+            __m512d leftGini = one, rightGini = one;
+            for (int c = 0; c < numClasses; ++c) {
+                __m512d leftCount = _mm512_cvtepi32_pd(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(&left[c * numCandidates + k])));
+                __m512d rightCount = _mm512_sub_pd(_mm512_set1_pd(stats.classCounts[c]), leftCount);
+                __m512d leftProbability = _mm512_div_pd(leftCount, leftSize);
+                __m512d rightProbability = _mm512_div_pd(rightCount, rightSize);
+                leftGini = _mm512_sub_pd(leftGini, _mm512_mul_pd(leftProbability, leftProbability));
+                rightGini = _mm512_sub_pd(rightGini, _mm512_mul_pd(rightProbability, rightProbability));
+            }
+            __m512d score = _mm512_add_pd(_mm512_mul_pd(_mm512_div_pd(leftSize, totalVector), leftGini),
+                                          _mm512_mul_pd(_mm512_div_pd(rightSize, totalVector), rightGini));
+            _mm512_storeu_pd(&scores[k], score);
+        }
+    }
+#elif defined(__AVX2__)
+    if constexpr (sizeof(Count) == sizeof(int)) {
+        __m256d one = _mm256_set1_pd(1.0), totalVector = _mm256_set1_pd(total);
+        for (; k + 4 <= numCandidates; k += 4) {
+            __m256d leftSize = _mm256_setzero_pd();
+            for (int c = 0; c < numClasses; ++c) {
+                leftSize = _mm256_add_pd(leftSize, _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&left[c * numCandidates + k]))));
+            }
+            __m256d rightSize = _mm256_sub_pd(totalVector, leftSize);
+            __m256d leftGini = one, rightGini = one;
+            for (int c = 0; c < numClasses; ++c) {
+                __m256d leftCount = _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&left[c * numCandidates + k])));
+                __m256d rightCount = _mm256_sub_pd(_mm256_set1_pd(stats.classCounts[c]), leftCount);
+                __m256d leftProbability = _mm256_div_pd(leftCount, leftSize);
+                __m256d rightProbability = _mm256_div_pd(rightCount, rightSize);
+                leftGini = _mm256_sub_pd(leftGini, _mm256_mul_pd(leftProbability, leftProbability));
+                rightGini = _mm256_sub_pd(rightGini, _mm256_mul_pd(rightProbability, rightProbability));
+            }
+            __m256d score = _mm256_add_pd(_mm256_mul_pd(_mm256_div_pd(leftSize, totalVector), leftGini),
+                                          _mm256_mul_pd(_mm256_div_pd(rightSize, totalVector), rightGini));
+            _mm256_storeu_pd(&scores[k], score);
+        }
+
+    }
+#endif
+    for (; k < numCandidates; ++k) {
+        double leftSize = 0.0;
+        for (int c = 0; c < numClasses; ++c) leftSize += left[c * numCandidates + k];
+        double rightSize = total - leftSize;
+        double leftGini = 1.0, rightGini = 1.0;
+        for (int c = 0; c < numClasses; ++c) {
+            double leftProbability = left[c * numCandidates + k] / leftSize;
+            double rightProbability = (stats.classCounts[c] - left[c * numCandidates + k]) / rightSize;
+            leftGini -= leftProbability * leftProbability;
+            rightGini -= rightProbability * rightProbability;
+        }
+        scores[k] = (leftSize / total) * leftGini + (rightSize / total) * rightGini;
+    }
+
+    // Horizontal argmin: the lowest score, then the first candidate reaching it
+    int best = min_element(scores, scores + numCandidates) - scores;
+    bestGini = scores[best];
+    for (int c = 0; c < numClasses; ++c) {
+        leftCounts[c] = left[c * numCandidates + best];
+    }
+    return best + 1;
+}
+
+// Structure to represent the exact score of a split as a fraction, higher is better.
+// For sides with class counts L and R, the weighted Gini impurity is 1 - (sum(L^2) / |L| + sum(R^2) / |R|) / n,
+// so a split is scored by sum(L^2) / |L| + sum(R^2) / |R| = (sum(L^2) * |R| + sum(R^2) * |L|) / (|L| * |R|).
+// Numerators stay below n^3 and denominators below n^2, so scores are exact for nodes of up to 2^42 rows.
+struct SplitScore {
+    unsigned __int128 numerator;
+    unsigned __int128 denominator;
+};
+
+// Function to multiply a 128-bit by a 64-bit unsigned integer into a 192-bit product
+void multiply192(unsigned __int128 a, uint64_t b, uint64_t& high, unsigned __int128& low) {
+    unsigned __int128 lowPart = static_cast<unsigned __int128>(static_cast<uint64_t>(a)) * b;
+    unsigned __int128 highPart = static_cast<unsigned __int128>(static_cast<uint64_t>(a >> 64)) * b;
+    low = lowPart + (highPart << 64);
+    high = static_cast<uint64_t>(highPart >> 64) + (low < lowPart ? 1 : 0);
+}
+
+// Function to multiply two 128-bit unsigned integers into a 256-bit product
+void multiply256(unsigned __int128 a, unsigned __int128 b, unsigned __int128& high, unsigned __int128& low) {
+    uint64_t middleHigh, highHigh;
+    unsigned __int128 middle;
+    multiply192(a, static_cast<uint64_t>(b), middleHigh, low);
+    multiply192(a, static_cast<uint64_t>(b >> 64), highHigh, middle);
+    unsigned __int128 upper = (static_cast<unsigned __int128>(highHigh) << 64 | static_cast<uint64_t>(middle >> 64)) + middleHigh;
+    unsigned __int128 previousLow = low;
+    low += middle << 64;
+    high = upper + (low < previousLow ? 1 : 0);
+}
+
+// Function to compare two split scores exactly by cross-multiplication, without any division.
+// Denominators only exceed 64 bits on nodes of more than 2^32 rows, which take the full 256-bit products.
+bool isBetterScore(const SplitScore& a, const SplitScore& b) {
+    if ((a.denominator >> 64) == 0 && (b.denominator >> 64) == 0) {
+        uint64_t leftHigh, rightHigh;
+        unsigned __int128 leftLow, rightLow;
+        multiply192(a.numerator, b.denominator, leftHigh, leftLow);
+        multiply192(b.numerator, a.denominator, rightHigh, rightLow);
+        return leftHigh != rightHigh ? leftHigh > rightHigh : leftLow > rightLow;
+    }
+    unsigned __int128 leftHigh, rightHigh, leftLow, rightLow;
+    multiply256(a.numerator, b.denominator, leftHigh, leftLow);
+    multiply256(b.numerator, a.denominator, rightHigh, rightLow);
+    return leftHigh != rightHigh ? leftHigh > rightHigh : leftLow > rightLow;
+}
+
+// Function to compute the score of leaving a node unsplit, sum(counts^2) / n, which any useful split must beat
+template <typename Count>
+SplitScore unsplitScore(const NodeStats<Count>& stats) {
+    unsigned __int128 squares = 0;
+    for (int c = 0; c < stats.numClasses; ++c) {
+        squares += static_cast<unsigned __int128>(stats.classCounts[c]) * stats.classCounts[c];
+    }
+    return {squares, static_cast<unsigned __int128>(stats.size)};
+}
+
+// Function to find the best threshold between consecutive runs with integer arithmetic only.
+// Returns the run r whose boundary with run r - 1 scores highest (the first one on ties), or -1 if the column has one run.
+template <typename Count>
+int findBestRunBoundaryExact(const Count* runClassCounts, int numRuns, const NodeStats<Count>& stats, ScratchArena<Count>& arena,
+                             SplitScore& bestScore, Count* leftCounts) {
+    int numClasses = stats.numClasses;
+    Count* left = arena.running.data();
+    fill(left, left + numClasses, 0);
+    int best = -1;
+
+    for (int r = 1; r < numRuns; ++r) {
+        uint64_t leftSize = 0;
+        unsigned __int128 leftSquares = 0, rightSquares = 0;
+        for (int c = 0; c < numClasses; ++c) {
+            left[c] += runClassCounts[(r - 1) * numClasses + c];
+            uint64_t leftCount = left[c], rightCount = stats.classCounts[c] - left[c];
+            if constexpr (sizeof(Count) == sizeof(int)) { // 32-bit counts square within 64 bits
+                leftSquares += leftCount * leftCount;
+                rightSquares += rightCount * rightCount;
+            } else {
+                leftSquares += static_cast<unsigned __int128>(leftCount) * leftCount;
+                rightSquares += static_cast<unsigned __int128>(rightCount) * rightCount;
+            }
+            leftSize += leftCount;
+        }
+        uint64_t rightSize = stats.size - leftSize;
+
+        SplitScore score = {leftSquares * rightSize + rightSquares * leftSize, static_cast<unsigned __int128>(leftSize) * rightSize};
+        if (best == -1 || isBetterScore(score, bestScore)) {
+            best = r;
+            bestScore = score;
+            copy(left, left + numClasses, leftCounts);
+        }
+    }
+    return best;
+}
+
+// Function to build the AVX2 shuffle table: entry m moves the lanes whose bit is set in m to the front
+const array<array<int, 8>, 256>& compressTable() {
+    static const array<array<int, 8>, 256> table = [] {
+        array<array<int, 8>, 256> t;
+        for (int mask = 0; mask < 256; ++mask) {
+            int count = 0;
+            for (int lane = 0; lane < 8; ++lane) {
+                if (mask & (1 << lane)) t[mask][count++] = lane;
+            }
+            while (count < 8) t[mask][count++] = 0;
+        }
+        return t;
+    }();
+    return table;
+}
+
+// Function to partition row indices by comparing a feature column against a threshold, without branching on the outcome.
+// Rows with column[row] < threshold go to leftRows, the others to rightRows, both in their original order.
+// Each output buffer must have room for count + 16 entries. Returns the number of left rows.
+int partitionRows(const double* column, const int* rows, int count, double threshold, int* leftRows, int* rightRows) {
+    int numLeft = 0, numRight = 0;
+    int i = 0;
+#if defined(__AVX512F__) && defined(__AVX512VL__)
+    // 16 rows at a time: two 8-wide gathers, then compress-store the indices of each side
+    __m512d limit = _mm512_set1_pd(threshold);
+    for (; i + 16 <= count; i += 16) {
+        __m512i indices = _mm512_loadu_si512(rows + i);
+        __m512d low = _mm512_i32gather_pd(_mm512_castsi512_si256(indices), column, 8);
+        __m512d high = _mm512_i32gather_pd(_mm512_extracti64x4_epi64(indices, 1), column, 8);
+        __mmask16 mask = _mm512_cmp_pd_mask(low, limit, _CMP_LT_OQ)
+                       | (static_cast<__mmask16>(_mm512_cmp_pd_mask(high, limit, _CMP_LT_OQ)) << 8);
+        _mm512_mask_compressstoreu_epi32(leftRows + numLeft, mask, indices);
+        _mm512_mask_compressstoreu_epi32(rightRows + numRight, static_cast<__mmask16>(~mask), indices);
+        int leftCount = __builtin_popcount(mask);
+        numLeft += leftCount;
+        numRight += 16 - leftCount;
+    }
+#elif defined(__AVX2__)
+    // 8 rows at a time: two 4-wide gathers, then a shuffle table packs the indices of each side
+    const array<array<int, 8>, 256>& table = compressTable();
+    __m256d limit = _mm256_set1_pd(threshold);
+    for (; i + 8 <= count; i += 8) {
+        __m256i indices = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows + i));
+        __m256d low = _mm256_i32gather_pd(column, _mm256_castsi256_si128(indices), 8);
+        __m256d high = _mm256_i32gather_pd(column, _mm256_extracti128_si256(indices, 1), 8);
+        int mask = _mm256_movemask_pd(_mm256_cmp_pd(low, limit, _CMP_LT_OQ))
+                 | (_mm256_movemask_pd(_mm256_cmp_pd(high, limit, _CMP_LT_OQ)) << 4);
+        __m256i leftOrder = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(table[mask].data()));
+        __m256i rightOrder = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(table[~mask & 0xFF].data()));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(leftRows + numLeft), _mm256_permutevar8x32_epi32(indices, leftOrder));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(rightRows + numRight), _mm256_permutevar8x32_epi32(indices, rightOrder));
+        int leftCount = __builtin_popcount(mask);
+        numLeft += leftCount;
+        numRight += 8 - leftCount;
+    }
+#endif
+    // Remaining rows: write to both sides and only advance the one that keeps the row
+    for (; i < count; ++i) {
+        int row = rows[i];
+        int goesLeft = column[row] < threshold;
+        leftRows[numLeft] = row;
+        rightRows[numRight] = row;
+        numLeft += goesLeft;
+        numRight += 1 - goesLeft;
+    }
+    return numLeft;
+}
+
+// Structure to represent a column that is still active in a node: its slot and its number of runs there
+struct ActiveColumn {
+    int slot;
+    int numRuns;
+};
+
+// Structure to hold the training state of the presorted engine.
+// Every feature owns a slot of flat arrays indexed by position. A node covers the same position range [begin, end)
+// in every slot, where its rows are sorted by the slot's feature and its runs are stored from position begin on.
+// Partitioning rewrites a node's range in place, so nothing is allocated per node once training has started.
+struct PresortedTrainer {
+    const ColumnStore& store;
+    TrainingOptions options;
+    int numClasses;
+
+    vector<int> slotFeature;                   // Feature index of each slot
+    vector<IndexVector<int>> slotRows;         // Row indices, sorted by value within each node's range
+    vector<IndexVector<double>> slotRunValues; // Value of each run of a node, from the node's first position
+    vector<IndexVector<int>> slotRunCounts;    // Class counts of those runs (position x numClasses)
+
+    // Active columns and class counts of the left (0) and right (1) node at each depth of the current path
+    vector<array<vector<ActiveColumn>, 2>> activeColumns;
+    vector<array<vector<int>, 2>> nodeCounts;
+    vector<uint64_t> leafCounts; // Training rows of every leaf built so far, in preorder
+
+    // Per-slot results of the split search and of the partition
+    vector<int> slotBoundary;
+    vector<SplitScore> slotScore;
+    vector<double> slotGini;
+    vector<char> slotHasGain;
+    vector<int> slotLeftCounts; // slot x numClasses
+    vector<int> slotChildRuns;  // Runs of the left and right child, slot x 2
+
+    ThreadPool pool;
+    vector<ScratchArena<int>> arenas; // One per worker
+
+    PresortedTrainer(const ColumnStore& store, const TrainingOptions& options)
+        : store(store), options(options), numClasses(store.numClasses), pool(options.numThreads),
+          arenas(pool.size(), ScratchArena<int>(store.labels.size(), store.numClasses, !options.exactScoring)) {}
+};
+
+// Function to make sure the per-depth buffers exist down to the given depth
+void ensureDepth(PresortedTrainer& trainer, int depth) {
+    while (static_cast<int>(trainer.activeColumns.size()) <= depth) {
+        array<vector<ActiveColumn>, 2> columns;
+        array<vector<int>, 2> counts;
+        for (int side = 0; side < 2; ++side) {
+            columns[side].reserve(trainer.slotFeature.size());
+            counts[side].assign(trainer.numClasses, 0);
+        }
+        trainer.activeColumns.push_back(move(columns));
+        trainer.nodeCounts.push_back(move(counts));
+    }
+}
+
+// Function to decide whether a node has enough work to spread its columns over the workers
+bool isParallelNode(const PresortedTrainer& trainer, int size, size_t numColumns) {
+    return trainer.pool.size() > 1 && numColumns > 1 && static_cast<long>(size) * numColumns >= 32768;
+}
+
+// Function to write a row at a position of a slot, extending the node's last run or starting a new one
+void appendToRuns(PresortedTrainer& trainer, int slot, int nodeBegin, int position, int row, int& numRuns) {
+    int numClasses = trainer.numClasses;
+    double value = trainer.store.columns[trainer.slotFeature[slot]][row];
+    double* runValues = &trainer.slotRunValues[slot][nodeBegin];
+    int* runCounts = &trainer.slotRunCounts[slot][static_cast<size_t>(nodeBegin) * numClasses];
+    if (numRuns == 0 || runValues[numRuns - 1] != value) {
+        runValues[numRuns] = value;
+        fill(runCounts + numRuns * numClasses, runCounts + (numRuns + 1) * numClasses, 0);
+        numRuns++;
+    }
+    trainer.slotRows[slot][position] = row;
+    runCounts[(numRuns - 1) * numClasses + trainer.store.labels[row]]++;
+}
+
+// Function to sort every feature column once and compress it into the runs of the root node.
+// If sortedRows is given, it already holds the rows of every feature in ascending order of its values (in any order
+// among equal values), as a sliding window maintains them, and nothing is sorted.
+void presortColumns(PresortedTrainer& trainer, const vector<int>& features, const vector<vector<int>>* sortedRows = nullptr) {
+    const ColumnStore& store = trainer.store;
+    int numDataPoints = store.labels.size();
+    ensureDepth(trainer, 0);
+
+    vector<int> sortedOrder(sortedRows == nullptr ? numDataPoints : 0);
+    for (int featureIndex : features) {
+        const double* values = store.columns[featureIndex];
+        if (sortedRows == nullptr) {
+            for (int i = 0; i < numDataPoints; ++i) sortedOrder[i] = i;
+            stable_sort(sortedOrder.begin(), sortedOrder.end(), [&values](int a, int b) {
+                return values[a] < values[b];
+            });
+        }
+        const vector<int>& order = sortedRows == nullptr ? sortedOrder : (*sortedRows)[featureIndex];
+
+        int slot = trainer.slotFeature.size();
+        trainer.slotFeature.push_back(featureIndex);
+        trainer.slotRows.emplace_back(numDataPoints);
+        trainer.slotRunValues.emplace_back(numDataPoints);
+        trainer.slotRunCounts.emplace_back(static_cast<size_t>(numDataPoints) * trainer.numClasses);
+        int numRuns = 0;
+        for (int i = 0; i < numDataPoints; ++i) {
+            appendToRuns(trainer, slot, 0, i, order[i], numRuns);
+        }
+
+        // A constant feature has no split candidate, so it is not scanned at all
+        if (numRuns > 1) {
+            trainer.activeColumns[0][0].push_back({slot, numRuns});
+        } else {
+            trainer.slotFeature.pop_back();
+            trainer.slotRows.pop_back();
+            trainer.slotRunValues.pop_back();
+            trainer.slotRunCounts.pop_back();
+        }
+    }
+
+    int numSlots = trainer.slotFeature.size();
+    trainer.slotBoundary.assign(numSlots, -1);
+    trainer.slotScore.assign(numSlots, SplitScore{0, 1});
+    trainer.slotGini.assign(numSlots, 0.0);
+    trainer.slotHasGain.assign(numSlots, 0);
+    trainer.slotLeftCounts.assign(static_cast<size_t>(numSlots) * trainer.numClasses, 0);
+    trainer.slotChildRuns.assign(numSlots * 2, 0);
+    for (int side = 0; side < 2; ++side) trainer.activeColumns[0][side].reserve(numSlots);
+}
+
+// Function to find the best split over the run-compressed columns of a node.
+// Candidates are only evaluated between distinct values, so a column with k runs costs k - 1 candidates.
+// Columns are scanned in parallel on large nodes and reduced in order, so the first best column wins either way.
+// The left class counts of the chosen split are written to leftCounts, and trainer.slotHasGain tells for each
+// column whether its best split lowers the node's impurity.
+SplitResult findBestSplitRuns(PresortedTrainer& trainer, const vector<ActiveColumn>& columns, int begin, const NodeStats<int>& stats,
+                              int* leftCounts) {
+    int numClasses = trainer.numClasses;
+    bool exactScoring = trainer.options.exactScoring;
+
+    auto scanColumn = [&](int worker, int i) {
+        const ActiveColumn& column = columns[i];
+        const int* runCounts = &trainer.slotRunCounts[column.slot][static_cast<size_t>(begin) * numClasses];
+        int* columnLeftCounts = &trainer.slotLeftCounts[static_cast<size_t>(column.slot) * numClasses];
+        if (exactScoring) {
+            trainer.slotBoundary[column.slot] = findBestRunBoundaryExact(runCounts, column.numRuns, stats, trainer.arenas[worker],
+                                                                         trainer.slotScore[column.slot], columnLeftCounts);
+        } else {
+            trainer.slotBoundary[column.slot] = findBestRunBoundary(runCounts, column.numRuns, stats, trainer.arenas[worker],
+                                                                    trainer.slotGini[column.slot], columnLeftCounts);
+        }
+    };
+    if (isParallelNode(trainer, stats.size, columns.size())) {
+        trainer.pool.parallelFor(columns.size(), scanColumn);
+    } else {
+        for (size_t i = 0; i < columns.size(); ++i) scanColumn(0, i);
+    }
+
+    SplitResult best = {-1, 0.0};
+    int bestSlot = -1;
+    SplitScore parentScore = unsplitScore(stats);
+    for (const ActiveColumn& column : columns) {
+        int slot = column.slot;
+        int r = trainer.slotBoundary[slot];
+        if (r == -1) continue;
+
+        bool isBetter;
+        if (exactScoring) {
+            isBetter = bestSlot == -1 || isBetterScore(trainer.slotScore[slot], trainer.slotScore[bestSlot]);
+            trainer.slotHasGain[slot] = isBetterScore(trainer.slotScore[slot], parentScore);
+        } else {
+            isBetter = bestSlot == -1 || trainer.slotGini[slot] < trainer.slotGini[bestSlot];
+            trainer.slotHasGain[slot] = trainer.slotGini[slot] < stats.gini;
+        }
+        if (isBetter) {
+            const double* runValues = &trainer.slotRunValues[slot][begin];
+            bestSlot = slot;
+            best.featureIndex = trainer.slotFeature[slot];
+            best.splitValue = (runValues[r - 1] + runValues[r]) / 2.0;
+        }
+    }
+
+    if (bestSlot != -1) {
+        const int* bestLeftCounts = &trainer.slotLeftCounts[static_cast<size_t>(bestSlot) * numClasses];
+        copy(bestLeftCounts, bestLeftCounts + numClasses, leftCounts);
+    }
+    return best;
+}
+
+// Function to partition every active column of the node [begin, end) into the columns of its children, in place.
+// Rows keep their sorted order, so the children's runs are rebuilt in the same pass.
+// Columns that become constant in a child are dropped from that child's active columns, and so are the
+// columns without gain if TrainingOptions::dropZeroGainFeatures is set.
+void partitionColumns(PresortedTrainer& trainer, const vector<ActiveColumn>& columns, int begin, int end, const SplitResult& split,
+                      vector<ActiveColumn>& leftColumns, vector<ActiveColumn>& rightColumns) {
+    const double* splitColumn = trainer.store.columns[split.featureIndex];
+    bool dropZeroGain = trainer.options.dropZeroGainFeatures;
+    int count = end - begin;
+
+    auto partitionColumn = [&](int worker, int i) {
+        int slot = columns[i].slot;
+        int leftRuns = 0, rightRuns = 0;
+        if (!dropZeroGain || trainer.slotHasGain[slot]) {
+            ScratchArena<int>& arena = trainer.arenas[worker];
+            int numLeft = partitionRows(splitColumn, &trainer.slotRows[slot][begin], count, split.splitValue,
+                                        arena.leftRows.data(), arena.rightRows.data());
+            for (int j = 0; j < numLeft; ++j) {
+                appendToRuns(trainer, slot, begin, begin + j, arena.leftRows[j], leftRuns);
+            }
+            for (int j = 0; j < count - numLeft; ++j) {
+                appendToRuns(trainer, slot, begin + numLeft, begin + numLeft + j, arena.rightRows[j], rightRuns);
+            }
+        }
+        trainer.slotChildRuns[2 * slot] = leftRuns;
+        trainer.slotChildRuns[2 * slot + 1] = rightRuns;
+    };
+    if (isParallelNode(trainer, count, columns.size())) {
+        trainer.pool.parallelFor(columns.size(), partitionColumn);
+    } else {
+        for (size_t i = 0; i < columns.size(); ++i) partitionColumn(0, i);
+    }
+
+    leftColumns.clear();
+    rightColumns.clear();
+    for (const ActiveColumn& column : columns) {
+        int leftRuns = trainer.slotChildRuns[2 * column.slot], rightRuns = trainer.slotChildRuns[2 * column.slot + 1];
+        if (leftRuns > 1) leftColumns.push_back({column.slot, leftRuns});
+        if (rightRuns > 1) rightColumns.push_back({column.slot, rightRuns});
+    }
+}
+
+// Function to build the decision tree recursively from run-compressed columns.
+// The node is the one on the given side at the given depth of the current path, starting at position begin;
+// its class statistics come from the parent's split, so no check here scans the rows.
+Node* buildTreeRuns(PresortedTrainer& trainer, int depth, int side, int begin) {
+    ensureDepth(trainer, depth + 1);
+    int numClasses = trainer.numClasses;
+    const vector<ActiveColumn>& columns = trainer.activeColumns[depth][side];
+    NodeStats<int> stats = makeNodeStats(trainer.nodeCounts[depth][side].data(), numClasses);
+
+    // If all data points have the same class label, create a leaf node
+    int majorityClass = max_element(stats.classCounts, stats.classCounts + numClasses) - stats.classCounts;
+    if (stats.classCounts[majorityClass] == stats.size) {
+        trainer.leafCounts.push_back(stats.size);
+        return new Node(majorityClass);
+    }
+
+    // Find the best split; without any candidate (no features, or all of them constant) create a majority leaf
+    int* leftCounts = trainer.nodeCounts[depth + 1][0].data();
+    int* rightCounts = trainer.nodeCounts[depth + 1][1].data();
+    SplitResult bestSplit = columns.empty() ? SplitResult{-1, 0.0} : findBestSplitRuns(trainer, columns, begin, stats, leftCounts);
+    if (bestSplit.featureIndex == -1) {
+        trainer.leafCounts.push_back(stats.size);
+        return new Node(majorityClass);
+    }
+
+    // The children's class counts follow from the chosen split
+    int numLeft = 0;
+    for (int c = 0; c < numClasses; ++c) {
+        rightCounts[c] = stats.classCounts[c] - leftCounts[c];
+        numLeft += leftCounts[c];
+    }
+
+    // Split the columns in place, keeping each of them sorted and run-compressed
+    partitionColumns(trainer, columns, begin, begin + stats.size, bestSplit,
+                     trainer.activeColumns[depth + 1][0], trainer.activeColumns[depth + 1][1]);
+
+    // Recursively build the left and right subtrees
+    Node* leftChild = buildTreeRuns(trainer, depth + 1, 0, begin);
+    Node* rightChild = buildTreeRuns(trainer, depth + 1, 1, begin + numLeft);
+
+    return new Node(bestSplit.featureIndex, bestSplit.splitValue, leftChild, rightChild);
+}
+
+// Function to build the decision tree with presorted, run-compressed columns.
+// Produces the same tree as buildTree, but sorts each feature only once. With exact scoring, splits that tie
+// exactly go to the first candidate, where buildTree's floating-point Gini may prefer one a rounding error lower.
+// Row indices and class counts are 32-bit, which keeps the per-feature arrays compact; the dataset must have
+// fewer than 2^31 rows.
+// sortedRows optionally gives the rows of every feature in ascending order of its values, as presortColumns takes it.
+// If leafCounts is given, it receives the number of training rows of every leaf in preorder.
+Node* buildTreePresorted(const ColumnStore& store, const vector<int>& features, const TrainingOptions& options,
+                         const vector<vector<int>>* sortedRows = nullptr, vector<uint64_t>* leafCounts = nullptr) {
+    PresortedTrainer trainer(store, options);
+    presortColumns(trainer, features, sortedRows);
+    for (int label : store.labels) {
+        trainer.nodeCounts[0][0][label]++;
+    }
+    Node* root = buildTreeRuns(trainer, 0, 0, 0);
+    if (leafCounts != nullptr) leafCounts->swap(trainer.leafCounts);
+    return root;
+}
+
+// Function to build the decision tree from a row-major dataset with the presorted engine
+Node* buildTreePresorted(const vector<vector<double>>& dataset, const vector<int>& features,
+                         const TrainingOptions& options = TrainingOptions()) {
+    return buildTreePresorted(buildColumnStore(dataset), features, options);
+}
+
+// Function to compute the bin boundaries of a column with at most maxBins bins.
+// Bins hold about the same number of rows and are only cut between distinct values; a column with at most
+// maxBins distinct values gets one bin per value, so binned training sees the same partitions as exact training.
+// The column is given by its distinct values in ascending order, with the number of rows holding each.
+vector<double> computeBinBoundaries(const vector<pair<double, long>>& runs, long count, int maxBins) {
+    vector<double> boundaries;
+    double rowsPerBin = static_cast<double>(count) / maxBins;
+    long position = runs.empty() ? 0 : runs[0].second; // First row of the current run in sorted order
+    for (size_t r = 1; r < runs.size() && static_cast<int>(boundaries.size()) + 1 < maxBins; ++r) {
+        if (runs.size() <= static_cast<size_t>(maxBins) || position >= (boundaries.size() + 1) * rowsPerBin) {
+            boundaries.push_back((runs[r - 1].first + runs[r].first) / 2.0);
+        }
+        position += runs[r].second;
+    }
+    return boundaries;
+}
+
+// Function to sort the values of a column into runs of distinct values, adding numZeros implicit zeros
+vector<pair<double, long>> sortIntoRuns(const double* values, long count, long numZeros = 0) {
+    vector<double> sorted(values, values + count);
+    sort(sorted.begin(), sorted.end());
+    vector<pair<double, long>> runs;
+    bool zerosAdded = numZeros == 0;
+    for (double value : sorted) {
+        if (!zerosAdded && value >= 0.0) {
+            runs.push_back({0.0, numZeros});
+            zerosAdded = true;
+        }
+        if (!runs.empty() && runs.back().first == value) {
+            runs.back().second++;
+        } else {
+            runs.push_back({value, 1});
+        }
+    }
+    if (!zerosAdded) runs.push_back({0.0, numZeros});
+    return runs;
+}
+
+// Function to find the bin of a value
+int findBin(const vector<double>& boundaries, double value) {
+    return upper_bound(boundaries.begin(), boundaries.end(), value) - boundaries.begin();
+}
+
+// Class to summarize a stream of values in bounded memory: a KLL quantile sketch.
+// Level h holds values that each stand for 2^h values of the stream. When a level is full, it is sorted and every
+// other value, starting from a random one of the first two, moves up a level. The top level holds about size values
+// and each level below two thirds of the one above, so the sketch keeps O(size log(count / size)) values and the rank
+// of any value is off by about count / size. Sketches of disjoint parts of a stream merge into a sketch of the whole.
+// Until a level is compacted, the sketch holds the stream exactly.
+class QuantileSketch {
+public:
+    explicit QuantileSketch(int size) : size(max(size, 8)) {}
+
+    void add(double value) {
+        if (levels.empty()) levels.emplace_back();
+        levels[0].push_back(value);
+        count++;
+        if (levels[0].size() >= levelCapacity(0)) compress();
+    }
+
+    void merge(const QuantileSketch& other) {
+        if (levels.size() < other.levels.size()) levels.resize(other.levels.size());
+        for (size_t level = 0; level < other.levels.size(); ++level) {
+            levels[level].insert(levels[level].end(), other.levels[level].begin(), other.levels[level].end());
+        }
+        count += other.count;
+        compress();
+    }
+
+    // Function to give the sketched values in ascending order, as runs of distinct values with the number of
+    // stream values each stands for, adding numZeros zeros that were not streamed
+    vector<pair<double, long>> weightedRuns(long numZeros = 0) const {
+        vector<pair<double, long>> items;
+        for (size_t level = 0; level < levels.size(); ++level) {
+            for (double value : levels[level]) items.push_back({value, 1L << level});
+        }
+        if (numZeros > 0) items.push_back({0.0, numZeros});
+        sort(items.begin(), items.end());
+        vector<pair<double, long>> runs;
+        for (const pair<double, long>& item : items) {
+            if (!runs.empty() && runs.back().first == item.first) {
+                runs.back().second += item.second;
+            } else {
+                runs.push_back(item);
+            }
+        }
+        return runs;
+    }
+
+    long numValues() const { return count; }
+
+private:
+    size_t levelCapacity(size_t level) const {
+        double capacity = size;
+        for (size_t above = level + 1; above < levels.size(); ++above) capacity *= 2.0 / 3.0;
+        return max<size_t>(2, capacity);
+    }
+
+    // Function to compact every level that is full into the level above; an odd largest value stays behind
+    void compress() {
+        for (size_t level = 0; level < levels.size(); ++level) {
+            if (levels[level].size() < levelCapacity(level)) continue;
+            if (level + 1 == levels.size()) levels.emplace_back();
+            vector<double>& items = levels[level];
+            sort(items.begin(), items.end());
+            size_t numPairs = items.size() / 2;
+            size_t offset = randomBit();
+            for (size_t i = 0; i < numPairs; ++i) levels[level + 1].push_back(items[2 * i + offset]);
+            items.erase(items.begin(), items.begin() + 2 * numPairs);
+        }
+    }
+
+    // Function to draw a pseudo-random bit (xorshift), the same sequence for every sketch so results are repeatable
+    size_t randomBit() {
+        random ^= random << 13;
+        random ^= random >> 7;
+        random ^= random << 17;
+        return random & 1;
+    }
+
+    int size;
+    long count = 0;
+    vector<vector<double>> levels;
+    uint64_t random = 0x9E3779B97F4A7C15ull;
+};
+
+// Number of values sketched apart and merged, in order, by sketchColumn; this makes the sketch independent of the
+// number of threads
+const long sketchChunkValues = 1 << 16;
+
+// Sketch size used for the bin boundaries under a memory limit when none is given; ranks are then off by about
+// 1/1024 of a column, well within the narrowest of 256 bins
+const int limitedSketchSize = 1024;
+
+// Function to sketch the values of a column, sketching chunks in parallel and merging them in order
+QuantileSketch sketchColumn(const double* values, long count, int sketchSize, ThreadPool& pool) {
+    QuantileSketch sketch(sketchSize);
+    long numChunks = (count + sketchChunkValues - 1) / sketchChunkValues;
+    long roundChunks = 4 * pool.size(); // Chunk sketches held at once
+    for (long first = 0; first < numChunks; first += roundChunks) {
+        vector<QuantileSketch> chunks(min(roundChunks, numChunks - first), QuantileSketch(sketchSize));
+        pool.parallelFor(chunks.size(), [&](int, int i) {
+            long begin = (first + i) * sketchChunkValues, end = min(count, begin + sketchChunkValues);
+            for (long value = begin; value < end; ++value) chunks[i].add(values[value]);
+        });
+        for (const QuantileSketch& chunk : chunks) sketch.merge(chunk);
+    }
+    return sketch;
+}
+
+// Function to compute the bin boundaries of the given features of a column store, exactly or from quantile sketches
+// of sketchSize (if not 0). A dataset quantized while it was loaded keeps its own boundaries.
+BinMapper buildBinMapper(const ColumnStore& store, const vector<int>& features, int maxBins, int sketchSize, ThreadPool& pool) {
+    if (store.isBinned()) return store.binMapper;
+    BinMapper mapper;
+    mapper.maxBins = maxBins;
+    mapper.boundaries.resize(store.numFeatures());
+    const SparseMatrix& sparse = store.sparseColumns;
+    for (int featureIndex : features) {
+        vector<pair<double, long>> runs;
+        if (store.isSparse()) {
+            long begin = sparse.offsets[featureIndex], count = sparse.offsets[featureIndex + 1] - begin;
+            if (sketchSize > 0) {
+                runs = sketchColumn(&sparse.values[begin], count, sketchSize, pool).weightedRuns(store.numRows - count);
+            } else {
+                runs = sortIntoRuns(&sparse.values[begin], count, store.numRows - count);
+            }
+        } else if (sketchSize > 0) {
+            runs = sketchColumn(store.columns[featureIndex], store.numRows, sketchSize, pool).weightedRuns();
+        } else {
+            runs = sortIntoRuns(store.columns[featureIndex], store.numRows);
+        }
+        mapper.boundaries[featureIndex] = computeBinBoundaries(runs, store.numRows, maxBins);
+    }
+    return mapper;
+}
+
+// Size of the blocks the ingestion pipeline reads, and number of leading rows it computes the bin boundaries from
+const size_t ingestBlockSize = 1 << 20;
+const long ingestSampleRows = 1 << 16;
+
+// Structure to hold the time each stage of the ingestion pipeline was busy, summed over its threads, and the
+// elapsed time of the whole pipeline, in seconds
+struct IngestStats {
+    double readSeconds = 0;
+    double parseSeconds = 0;
+    double binSeconds = 0;
+    double totalSeconds = 0;
+};
+
+// Structure to hold a block of a file as it moves through the ingestion pipeline
+struct IngestBlock {
+    long sequence; // Position of the block in the file
+    string text;   // Whole lines, released once parsed
+    LibSvmChunk rows;
+    long firstRow; // Row of the store that the block's first row goes to
+};
+
+// Function to load a LibSVM file straight into a quantized column store with at most maxBins bins per feature.
+// The stages overlap: a reader thread reads blocks of whole lines with pread, parser threads parse them, and binning
+// threads quantize their rows into the binned columns, with bounded queues in between, so that ingestion takes about
+// as long as its slowest stage. Blocks are numbered in file order once parsed. The bin boundaries are computed from
+// the first ingestSampleRows rows (all rows of smaller files, which are then binned exactly as in training). A feature
+// that first occurs after them gets its column when the block it first occurs in is numbered, with boundaries from
+// that block's rows; the rows before it hold the bin of zero. The columns are sized from the sample and grown if the
+// estimate falls short.
+// Returns false if the file cannot be read or has a malformed line or label.
+bool ingestLibSvm(const string& path, int maxBins, int numThreads, ColumnStore& store, IngestStats& stats) {
+    typedef chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) return false;
+    struct stat status;
+    long fileSize = fstat(fd, &status) == 0 ? status.st_size : 0;
+
+    store = ColumnStore();
+    stats = IngestStats();
+    maxBins = min(max(maxBins, 2), 256);
+    int numParsers = max(1, numThreads / 2);
+    int numBinners = max(1, numThreads - numParsers);
+    BoundedQueue<unique_ptr<IngestBlock>> textQueue(2 * numParsers), rowQueue(2 * numBinners);
+    atomic<bool> failed{false};
+    mutex statsMutex;
+    auto addTime = [&](double& seconds, Clock::time_point begin) {
+        lock_guard<mutex> lock(statsMutex);
+        seconds += chrono::duration<double>(Clock::now() - begin).count();
+    };
+
+    // Rows are numbered under orderMutex; until the boundaries are known, the numbered blocks are held as the sample
+    mutex orderMutex;
+    condition_variable orderChanged;
+    long nextSequence = 0, numRows = 0, sampleBytes = 0;
+    vector<unique_ptr<IngestBlock>> sample;
+    bool binning = false;
+    vector<uint8_t> zeroBins; // Bin of zero per feature, for the values a row does not store
+
+    // The binned columns and labels have room for capacity rows; binning threads write them under a shared lock
+    // and grow them under an exclusive one
+    shared_mutex growMutex;
+    long capacity = 0;
+    DatasetVector<double> labels;
+    auto resizeColumns = [&](long rows) {
+        for (DatasetVector<uint8_t>& column : store.binnedColumns) column.resize(rows);
+        labels.resize(rows);
+        capacity = rows;
+    };
+
+    // Function to compute the bin boundaries from the sample and send its blocks on, with orderMutex held
+    auto startBinning = [&](long expectedRows) {
+        int numColumns = 0;
+        for (const unique_ptr<IngestBlock>& block : sample) numColumns = max<long>(numColumns, block->rows.numColumns);
+        vector<vector<double>> values(numColumns);
+        for (const unique_ptr<IngestBlock>& block : sample) {
+            if (!block->rows.valid) continue; // Partly parsed, ingestion fails anyway
+            for (size_t i = 0; i < block->rows.indices.size(); ++i) {
+                values[block->rows.indices[i]].push_back(block->rows.values[i]);
+            }
+        }
+        store.binMapper.maxBins = maxBins;
+        store.binMapper.boundaries.resize(numColumns);
+        for (int column = 0; column < numColumns; ++column) {
+            long count = values[column].size();
+            vector<pair<double, long>> runs = sortIntoRuns(values[column].data(), count, numRows - count);
+            store.binMapper.boundaries[column] = computeBinBoundaries(runs, numRows, maxBins);
+            zeroBins.push_back(findBin(store.binMapper.boundaries[column], 0.0));
+        }
+        store.binnedColumns.resize(numColumns);
+        resizeColumns(max(expectedRows, numRows));
+        binning = true;
+        for (unique_ptr<IngestBlock>& block : sample) rowQueue.push(move(block));
+        sample.clear();
+    };
+
+    // Function to add the columns of the features a block has past the known ones, with orderMutex held once binning
+    // has started. Their boundaries come from the block's rows; the rows before it do not have them, so hold zero.
+    auto addColumns = [&](const LibSvmChunk& rows) {
+        int oldColumns = store.binMapper.boundaries.size();
+        int numColumns = rows.numColumns;
+        long blockRows = rows.labels.size();
+        vector<vector<double>> values(numColumns - oldColumns);
+        for (size_t i = 0; i < rows.indices.size(); ++i) {
+            if (rows.indices[i] >= oldColumns) values[rows.indices[i] - oldColumns].push_back(rows.values[i]);
+        }
+        unique_lock<shared_mutex> growLock(growMutex);
+        store.binMapper.boundaries.resize(numColumns);
+        store.binnedColumns.resize(numColumns);
+        for (int column = oldColumns; column < numColumns; ++column) {
+            vector<double>& columnValues = values[column - oldColumns];
+            long count = columnValues.size();
+            vector<pair<double, long>> runs = sortIntoRuns(columnValues.data(), count, blockRows - count);
+            store.binMapper.boundaries[column] = computeBinBoundaries(runs, blockRows, maxBins);
+            zeroBins.push_back(findBin(store.binMapper.boundaries[column], 0.0));
+            store.binnedColumns[column].assign(capacity, zeroBins[column]);
+        }
+    };
+
+    thread reader([&] {
+        string carry; // Partial last line of the previous block
+        long offset = 0;
+        for (long sequence = 0; !failed; ++sequence) {
+            Clock::time_point begin = Clock::now();
+            unique_ptr<IngestBlock> block(new IngestBlock());
+            block->sequence = sequence;
+            block->text.swap(carry);
+            size_t kept = block->text.size();
+            block->text.resize(kept + ingestBlockSize);
+            ssize_t bytesRead = pread(fd, &block->text[kept], ingestBlockSize, offset);
+            if (bytesRead < 0) {
+                failed = true;
+                break;
+            }
+            offset += bytesRead;
+            block->text.resize(kept + bytesRead);
+            if (bytesRead > 0) {
+                size_t lineEnd = block->text.rfind('\n');
+                size_t cut = lineEnd == string::npos ? 0 : lineEnd + 1;
+                carry.assign(block->text, cut, string::npos);
+                block->text.resize(cut);
+            }
+            addTime(stats.readSeconds, begin);
+            if (bytesRead == 0 && block->text.empty()) break;
+            textQueue.push(move(block));
+            if (bytesRead == 0) break;
+        }
+        textQueue.close();
+    });
+
+    auto parse = [&] {
+        unique_ptr<IngestBlock> block;
+        while (textQueue.pop(block)) {
+            Clock::time_point begin = Clock::now();
+            parseLibSvmChunk(block->text.data(), block->text.data() + block->text.size(), block->rows);
+            if (!block->rows.valid) failed = true;
+            long textBytes = block->text.size();
+            string().swap(block->text);
+            addTime(stats.parseSeconds, begin);
+
+            unique_lock<mutex> lock(orderMutex);
+            orderChanged.wait(lock, [&] { return nextSequence == block->sequence; });
+            block->firstRow = numRows;
+            numRows += block->rows.labels.size();
+            nextSequence++;
+            orderChanged.notify_all();
+            if (binning) {
+                if (block->rows.numColumns > static_cast<long>(store.binMapper.boundaries.size())) addColumns(block->rows);
+                lock.unlock();
+                rowQueue.push(move(block));
+                continue;
+            }
+            sampleBytes += textBytes;
+            sample.push_back(move(block));
+            if (numRows >= ingestSampleRows) {
+                startBinning(static_cast<long>(static_cast<double>(numRows) / sampleBytes * fileSize * 1.125));
+            }
+        }
+    };
+
+    auto bin = [&] {
+        unique_ptr<IngestBlock> block;
+        while (rowQueue.pop(block)) {
+            if (failed) continue;
+            Clock::time_point begin = Clock::now();
+            const LibSvmChunk& rows = block->rows;
+            long firstRow = block->firstRow, endRow = firstRow + rows.labels.size();
+            shared_lock<shared_mutex> lock(growMutex);
+            if (endRow > capacity) {
+                lock.unlock();
+                {
+                    unique_lock<shared_mutex> growLock(growMutex);
+                    if (endRow > capacity) resizeColumns(max(endRow, 2 * capacity));
+                }
+                lock.lock();
+            }
+
+            int numColumns = store.binnedColumns.size();
+            for (int column = 0; column < numColumns; ++column) {
+                fill(&store.binnedColumns[column][firstRow], &store.binnedColumns[column][0] + endRow, zeroBins[column]);
+            }
+            long value = 0;
+            for (long row = firstRow; row < endRow; ++row) {
+                labels[row] = rows.labels[row - firstRow];
+                for (long rowEnd = value + rows.rowLengths[row - firstRow]; value < rowEnd; ++value) {
+                    long column = rows.indices[value];
+                    if (column < numColumns) {
+                        store.binnedColumns[column][row] = findBin(store.binMapper.boundaries[column], rows.values[value]);
+                    }
+                }
+            }
+            lock.unlock();
+            block.reset();
+            addTime(stats.binSeconds, begin);
+        }
+    };
+
+    vector<thread> parsers, binners;
+    for (int i = 0; i < numParsers; ++i) parsers.emplace_back(parse);
+    for (int i = 0; i < numBinners; ++i) binners.emplace_back(bin);
+    reader.join();
+    for (thread& parser : parsers) parser.join();
+    if (!binning) startBinning(numRows);
+    rowQueue.close();
+    for (thread& binner : binners) binner.join();
+    close(fd);
+
+    resizeColumns(numRows);
+    store.numRows = numRows;
+    bool loaded = !failed && importLibSvmLabels(labels.data(), numRows, store);
+    DatasetVector<double>().swap(labels);
+    stats.totalSeconds = chrono::duration<double>(Clock::now() - start).count();
+    return loaded;
+}
+
+// Structure to hold the rows a histogram trainer partitions: the bin columns and labels they index, and the row
+// indices themselves, of type Row. Nodes cover ranges [begin, end) of the row index array, partitioned in place.
+template <typename Row>
+struct RowSet {
+    vector<const uint8_t*> bins;  // bins[i][row] for trainer.features[i]
+    const int* labels;
+    IndexVector<Row> rows;        // Row indices, partitioned in place per node
+    IndexVector<Row> rightBuffer; // Right side of a partition before it is copied back
+    bool numaBlocks;              // Row ids follow the per-NUMA-node blocks of the trainer
+};
+
+// Structure to hold the training state of the histogram engine.
+// Features are quantized once to bin ids. A node covers a range [begin, end) of a row set, which is partitioned
+// in place, and its splits are found from per-bin class counts rather than sorted columns.
+// The dataset's row set uses 32-bit row indices below 2^32 rows and 64-bit ones above. In larger datasets, a subtree
+// of at most localRowLimit rows is copied into a compact local row set with 16-bit indices and its own bin columns.
+// Histograms are kept in a cache of at most maxCachedHistograms buffers, bounded by the memory limit: a child
+// whose histogram is cached gets it by subtracting its sibling's from the parent's; the others rebuild theirs.
+struct HistogramTrainer {
+    const DatasetVector<int>& labels;
+    TrainingOptions options;
+    ThreadPool pool;
+    vector<long> rowBlockBegin;              // First row of each NUMA node's block, plus the number of rows
+    vector<HistogramVector<long>> partialHistograms; // One per worker, for parallel histogram construction
+    int numClasses;
+    int maxBins;
+    BinMapper mapper;
+    vector<int> features;                    // Features with more than one bin
+    vector<DatasetVector<uint8_t>> bins;     // bins[i][row] for features[i]
+    RowSet<uint32_t> narrowRows;             // The dataset's rows, below 2^32 rows
+    RowSet<uint64_t> wideRows;               // The dataset's rows, from 2^32 rows on
+    RowSet<uint16_t> localRows;              // The rows of the current small subtree
+    vector<IndexVector<uint8_t>> localBins;  // Bin columns of the current small subtree
+    IndexVector<int> localLabels;
+    size_t histogramSize;                    // features.size() x maxBins x numClasses counts
+    vector<HistogramVector<long>> histograms; // histograms[0] is scratch, the others form the cache
+    vector<int> freeHistograms;              // Cached buffers not held by any node
+    vector<array<vector<long>, 2>> nodeCounts; // Class counts of the left/right node at each depth
+    vector<uint64_t> leafCounts;             // Training rows of every leaf built so far, in preorder
+    ScratchArena<long> arena;
+    IndexVector<long> runCounts;             // Class counts of the non-empty bins of one feature
+    vector<int> runBins;                     // Bin id of each of those
+    vector<long> candidateLeftCounts;
+
+    static const int maxCachedHistograms = 64;
+    static constexpr long localRowLimit = 65536;
+
+    // If releaseStore is given, it is the store itself, whose raw columns are released as they are binned
+    HistogramTrainer(const ColumnStore& store, const vector<int>& candidateFeatures, const TrainingOptions& options,
+                     ColumnStore* releaseStore = nullptr);
+};
+
+// Function to give a worker its share of the positions [begin, end) of a node.
+// With NUMA partitioning, the workers of a node share the positions holding rows of that node's block;
+// rows are in ascending order within every node's range, since all partitions are stable.
+template <typename Row>
+pair<long, long> workerPositions(const HistogramTrainer& trainer, const RowSet<Row>& rowSet, int worker, long begin, long end) {
+    int numWorkers = trainer.pool.size();
+    if (rowSet.numaBlocks && trainer.options.numaPolicy == TrainingOptions::NumaPartition) {
+        int numNodes = trainer.pool.numNodes();
+        int node = trainer.pool.nodeOfWorker(worker);
+        const Row* rows = rowSet.rows.data();
+        long nodeBegin, nodeEnd;
+        if (rowSet.rows.empty()) {
+            // Not filled yet, while the dataset is binned: positions are row ids
+            nodeBegin = clamp(trainer.rowBlockBegin[node], begin, end);
+            nodeEnd = clamp(trainer.rowBlockBegin[node + 1], begin, end);
+        } else {
+            nodeBegin = lower_bound(rows + begin, rows + end, trainer.rowBlockBegin[node]) - rows;
+            nodeEnd = lower_bound(rows + begin, rows + end, trainer.rowBlockBegin[node + 1]) - rows;
+        }
+        begin = nodeBegin;
+        end = nodeEnd;
+        numWorkers = (numWorkers - node + numNodes - 1) / numNodes;
+        worker /= numNodes;
+    }
+    long size = end - begin;
+    return make_pair(begin + size * worker / numWorkers, begin + size * (worker + 1) / numWorkers);
+}
+
+// Features are binned in batches of at least this many raw bytes when their raw columns are released as they go,
+// so that the workers meet once per batch rather than once per feature
+const long releaseBatchBytes = 1 << 20;
+
+// Function to set up the row set of the whole dataset and quantize the columns, each worker binning its own rows.
+// With a releaseStore, the raw columns are freed batch by batch as soon as they are binned: dense columns are
+// released, and the pages of a spilled sparse matrix that no later feature needs are discarded.
+template <typename Row>
+void binDataset(HistogramTrainer& trainer, const ColumnStore& store, RowSet<Row>& rowSet, ColumnStore* releaseStore) {
+    long numDataPoints = store.labels.size();
+    rowSet.labels = store.labels.data();
+    rowSet.numaBlocks = true;
+    auto fillRows = [&rowSet, numDataPoints] {
+        rowSet.rows.resize(numDataPoints);
+        for (long i = 0; i < numDataPoints; ++i) rowSet.rows[i] = i;
+        rowSet.rightBuffer.resize(numDataPoints);
+    };
+    // The row indices are held in memory, and bin columns that do not fit beside them are spilled; with released raw
+    // columns, the indices take the place of those after binning instead
+    if (releaseStore == nullptr || store.isBinned()) fillRows();
+    if (store.isBinned()) {
+        // Quantized while loading: train on the store's own bin columns
+        for (int featureIndex : trainer.features) rowSet.bins.push_back(store.binnedColumns[featureIndex].data());
+        return;
+    }
+
+    const SparseMatrix& sparse = store.sparseColumns;
+    size_t numFeatures = trainer.features.size();
+    map<const double*, DatasetVector<double>*> owners; // Owned storage of each dense column
+    vector<long> neededFrom(numFeatures + 1, sparse.values.size()); // First sparse value that features i on need
+    if (releaseStore != nullptr) {
+        for (DatasetVector<double>& column : releaseStore->ownedColumns) owners[column.data()] = &column;
+        for (size_t i = numFeatures; store.isSparse() && i-- > 0;) {
+            neededFrom[i] = min(neededFrom[i + 1], sparse.offsets[trainer.features[i]]);
+        }
+    }
+    for (size_t batchBegin = 0, batchEnd = 0; batchBegin < numFeatures; batchBegin = batchEnd) {
+        long batchBytes = 0;
+        while (batchEnd < numFeatures && (releaseStore == nullptr || batchBytes < releaseBatchBytes)) {
+            int featureIndex = trainer.features[batchEnd++];
+            batchBytes += store.isSparse() ? (sparse.offsets[featureIndex + 1] - sparse.offsets[featureIndex]) * (sizeof(long) + sizeof(double))
+                                           : numDataPoints * sizeof(double);
+        }
+        for (size_t i = batchBegin; i < batchEnd; ++i) trainer.bins[i].resize(numDataPoints);
+
+        trainer.pool.forEachWorker([&](int worker) {
+            pair<long, long> range = workerPositions(trainer, rowSet, worker, 0, numDataPoints);
+            for (size_t i = batchBegin; i < batchEnd; ++i) {
+                const vector<double>& boundaries = trainer.mapper.boundaries[trainer.features[i]];
+                uint8_t* bins = trainer.bins[i].data();
+                if (!store.isSparse()) {
+                    const double* column = store.columns[trainer.features[i]];
+                    for (long row = range.first; row < range.second; ++row) {
+                        bins[row] = findBin(boundaries, column[row]);
+                    }
+                    continue;
+                }
+
+                // Sparse column: the worker's rows get the bin of zero, then its stored values are scattered
+                fill(bins + range.first, bins + range.second, findBin(boundaries, 0.0));
+                const long* rows = sparse.indices.data();
+                const long* first = lower_bound(rows + sparse.offsets[trainer.features[i]], rows + sparse.offsets[trainer.features[i] + 1], range.first);
+                const long* last = lower_bound(first, rows + sparse.offsets[trainer.features[i] + 1], range.second);
+                for (const long* entry = first; entry < last; ++entry) {
+                    bins[*entry] = findBin(boundaries, sparse.values[entry - rows]);
+                }
+            }
+        });
+
+        if (releaseStore == nullptr) continue;
+        if (store.isSparse()) {
+            discardSpilledPages(sparse.indices.data(), sparse.indices.data(), sparse.indices.data() + neededFrom[batchEnd]);
+            discardSpilledPages(sparse.values.data(), sparse.values.data(), sparse.values.data() + neededFrom[batchEnd]);
+            continue;
+        }
+        for (size_t i = batchBegin; i < batchEnd; ++i) {
+            auto owner = owners.find(store.columns[trainer.features[i]]);
+            if (owner != owners.end()) DatasetVector<double>().swap(*owner->second);
+            releaseStore->columns[trainer.features[i]] = nullptr;
+        }
+    }
+    for (const DatasetVector<uint8_t>& column : trainer.bins) rowSet.bins.push_back(column.data());
+    if (releaseStore != nullptr) fillRows();
+}
+
+HistogramTrainer::HistogramTrainer(const ColumnStore& store, const vector<int>& candidateFeatures, const TrainingOptions& options,
+                                   ColumnStore* releaseStore)
+    : labels(store.labels), options(options), pool(options.numThreads), numClasses(store.numClasses),
+      maxBins(store.isBinned() ? store.binMapper.maxBins : min(max(options.maxBins, 2), 256)),
+      mapper(buildBinMapper(store, candidateFeatures, maxBins, options.sketchSize, pool)),
+      arena(maxBins, store.numClasses, !options.exactScoring), runCounts(static_cast<size_t>(maxBins) * store.numClasses), runBins(maxBins),
+      candidateLeftCounts(store.numClasses) {
+    long numDataPoints = store.labels.size();
+
+    // Give every NUMA node a contiguous block of rows
+    if (options.numaPolicy == TrainingOptions::NumaPartition) {
+        pool.pinWorkers(readNumaTopology());
+    }
+    int numNodes = pool.numNodes();
+    for (int node = 0; node <= numNodes; ++node) {
+        rowBlockBegin.push_back(numDataPoints * node / numNodes);
+    }
+
+    for (int featureIndex : candidateFeatures) {
+        if (mapper.boundaries[featureIndex].empty()) continue;
+        features.push_back(featureIndex);
+        if (!store.isBinned()) bins.emplace_back(); // Sized as the feature is binned
+    }
+    if (numDataPoints > numeric_limits<uint32_t>::max()) {
+        binDataset(*this, store, wideRows, releaseStore);
+    } else {
+        binDataset(*this, store, narrowRows, releaseStore);
+    }
+
+    histogramSize = features.size() * maxBins * numClasses;
+    histograms.emplace_back(histogramSize);
+}
+
+// Function to make sure the per-depth class count buffers exist down to the given depth
+void ensureDepth(HistogramTrainer& trainer, int depth) {
+    while (static_cast<int>(trainer.nodeCounts.size()) <= depth) {
+        array<vector<long>, 2> counts;
+        counts[0].assign(trainer.numClasses, 0);
+        counts[1].assign(trainer.numClasses, 0);
+        trainer.nodeCounts.push_back(move(counts));
+    }
+}
+
+// Function to take a histogram buffer from the cache; returns -1 if the cache is full or memory is short
+int acquireHistogram(HistogramTrainer& trainer) {
+    if (!trainer.freeHistograms.empty()) {
+        int id = trainer.freeHistograms.back();
+        trainer.freeHistograms.pop_back();
+        return id;
+    }
+    if (static_cast<int>(trainer.histograms.size()) > HistogramTrainer::maxCachedHistograms
+        || !fitsInMemory(trainer.histogramSize * sizeof(long))) {
+        return -1;
+    }
+    trainer.histograms.emplace_back(trainer.histogramSize);
+    return trainer.histograms.size() - 1;
+}
+
+// Function to give a cached histogram buffer back; the scratch buffer and -1 are ignored
+void releaseHistogram(HistogramTrainer& trainer, int id) {
+    if (id > 0) trainer.freeHistograms.push_back(id);
+}
+
+// Function to count the classes of the rows at positions [begin, end) per feature and bin into a histogram
+template <typename Row>
+void accumulateHistogram(const HistogramTrainer& trainer, const RowSet<Row>& rowSet, long* histogram, long begin, long end) {
+    const long prefetchDistance = 16; // Rows ahead, enough to cover a memory access at a few cycles per row
+    int numClasses = trainer.numClasses;
+    const Row* rows = rowSet.rows.data();
+    const int* labels = rowSet.labels;
+    long prefetchEnd = trainer.options.prefetch ? max(begin, end - prefetchDistance) : begin;
+    for (size_t i = 0; i < trainer.features.size(); ++i) {
+        const uint8_t* bins = rowSet.bins[i];
+        long* featureHistogram = histogram + i * trainer.maxBins * numClasses;
+        long position = begin;
+        for (; position < prefetchEnd; ++position) {
+            Row ahead = rows[position + prefetchDistance];
+            __builtin_prefetch(&bins[ahead]);
+            __builtin_prefetch(&labels[ahead]);
+            Row row = rows[position];
+            featureHistogram[bins[row] * numClasses + labels[row]]++;
+        }
+        for (; position < end; ++position) {
+            Row row = rows[position];
+            featureHistogram[bins[row] * numClasses + labels[row]]++;
+        }
+    }
+}
+
+// Function to build the histogram of the rows in [begin, end).
+// On large nodes every worker counts its share of the rows (its NUMA node's rows when partitioned) into its own
+// partial histogram, and the partial histograms are then summed feature by feature.
+template <typename Row>
+void buildHistogram(HistogramTrainer& trainer, const RowSet<Row>& rowSet, int id, long begin, long end) {
+    long* histogram = trainer.histograms[id].data();
+    size_t histogramSize = trainer.histogramSize;
+    fill(histogram, histogram + histogramSize, 0);
+    if (trainer.pool.size() == 1 || (end - begin) * static_cast<long>(trainer.features.size()) < 65536) {
+        accumulateHistogram(trainer, rowSet, histogram, begin, end);
+        return;
+    }
+
+    if (trainer.partialHistograms.empty()) {
+        trainer.partialHistograms.assign(trainer.pool.size(), HistogramVector<long>(histogramSize));
+    }
+    trainer.pool.forEachWorker([&](int worker) {
+        long* partial = trainer.partialHistograms[worker].data();
+        fill(partial, partial + histogramSize, 0);
+        pair<long, long> range = workerPositions(trainer, rowSet, worker, begin, end);
+        accumulateHistogram(trainer, rowSet, partial, range.first, range.second);
+    });
+    size_t featureSize = static_cast<size_t>(trainer.maxBins) * trainer.numClasses;
+    trainer.pool.parallelFor(trainer.features.size(), [&](int, int i) {
+        long* target = histogram + i * featureSize;
+        for (const HistogramVector<long>& partial : trainer.partialHistograms) {
+            const long* source = partial.data() + i * featureSize;
+            for (size_t j = 0; j < featureSize; ++j) target[j] += source[j];
+        }
+    });
+}
+
+// Function to subtract the histogram of one child from its parent's, leaving the other child's in the parent's buffer
+void subtractHistogram(HistogramTrainer& trainer, int parent, int child) {
+    long* target = trainer.histograms[parent].data();
+    const long* source = trainer.histograms[child].data();
+    for (size_t i = 0; i < trainer.histogramSize; ++i) {
+        target[i] -= source[i];
+    }
+}
+
+// Function to find the best split of a node from its histogram. The non-empty bins of each feature are scored
+// like the runs of a sorted column, and the threshold is the upper boundary of the last bin going left.
+// Also returns the position of the feature in trainer.features and that bin, for partitioning.
+SplitResult findBestSplitHistogram(HistogramTrainer& trainer, const long* histogram, const NodeStats<long>& stats, long* leftCounts,
+                                   int& splitFeature, int& splitBin) {
+    int numClasses = trainer.numClasses;
+    SplitResult best = {-1, 0.0};
+    SplitScore bestScore = {0, 1};
+    double bestGini = numeric_limits<double>::infinity();
+
+    for (size_t i = 0; i < trainer.features.size(); ++i) {
+        // Compress the feature's histogram to its non-empty bins
+        const long* featureHistogram = histogram + i * trainer.maxBins * numClasses;
+        int numRuns = 0;
+        for (int bin = 0; bin < trainer.maxBins; ++bin) {
+            const long* binCounts = featureHistogram + bin * numClasses;
+            if (all_of(binCounts, binCounts + numClasses, [](long count) { return count == 0; })) continue;
+            copy(binCounts, binCounts + numClasses, &trainer.runCounts[numRuns * numClasses]);
+            trainer.runBins[numRuns++] = bin;
+        }
+
+        bool isBetter;
+        int r;
+        if (trainer.options.exactScoring) {
+            SplitScore score;
+            r = findBestRunBoundaryExact(trainer.runCounts.data(), numRuns, stats, trainer.arena, score, trainer.candidateLeftCounts.data());
+            isBetter = r != -1 && (best.featureIndex == -1 || isBetterScore(score, bestScore));
+            if (isBetter) bestScore = score;
+        } else {
+            double gini;
+            r = findBestRunBoundary(trainer.runCounts.data(), numRuns, stats, trainer.arena, gini, trainer.candidateLeftCounts.data());
+            isBetter = r != -1 && gini < bestGini;
+            if (isBetter) bestGini = gini;
+        }
+
+        if (isBetter) {
+            int featureIndex = trainer.features[i];
+            splitFeature = i;
+            splitBin = trainer.runBins[r - 1];
+            best.featureIndex = featureIndex;
+            best.splitValue = trainer.mapper.boundaries[featureIndex][splitBin];
+            copy(trainer.candidateLeftCounts.begin(), trainer.candidateLeftCounts.end(), leftCounts);
+        }
+    }
+    return best;
+}
+
+// Function to partition the rows of [begin, end) in place by bin, without branching; returns the number of left rows
+template <typename Row>
+long partitionBinnedRows(RowSet<Row>& rowSet, long begin, long end, int splitFeature, int splitBin) {
+    const uint8_t* bins = rowSet.bins[splitFeature];
+    Row* rows = rowSet.rows.data();
+    Row* rightRows = rowSet.rightBuffer.data();
+    long numLeft = 0, numRight = 0;
+    for (long position = begin; position < end; ++position) {
+        Row row = rows[position];
+        long goesLeft = bins[row] <= splitBin;
+        rows[begin + numLeft] = row;
+        rightRows[numRight] = row;
+        numLeft += goesLeft;
+        numRight += 1 - goesLeft;
+    }
+    copy(rightRows, rightRows + numRight, rows + begin + numLeft);
+    return numLeft;
+}
+
+// Function to allocate the local row set on first use. Only datasets larger than a local row set use one,
+// and only while it fits in memory; returns whether it is available.
+bool reserveLocalRows(HistogramTrainer& trainer) {
+    RowSet<uint16_t>& local = trainer.localRows;
+    if (!local.rows.empty()) return true;
+    long capacity = HistogramTrainer::localRowLimit;
+    if (static_cast<long>(trainer.labels.size()) <= capacity
+        || !fitsInMemory(capacity * (trainer.features.size() + sizeof(int) + 2 * sizeof(uint16_t)))) {
+        return false;
+    }
+    trainer.localBins.assign(trainer.features.size(), IndexVector<uint8_t>(capacity));
+    trainer.localLabels.resize(capacity);
+    for (const IndexVector<uint8_t>& column : trainer.localBins) local.bins.push_back(column.data());
+    local.labels = trainer.localLabels.data();
+    local.rows.resize(capacity);
+    local.rightBuffer.resize(capacity);
+    local.numaBlocks = false;
+    return true;
+}
+
+// Function to copy the rows at positions [begin, begin + size) of a row set into the local row set,
+// gathering their bins and labels so that the subtree works on contiguous data with 16-bit row indices
+template <typename Row>
+void gatherLocalRows(HistogramTrainer& trainer, const RowSet<Row>& rowSet, long begin, long size) {
+    RowSet<uint16_t>& local = trainer.localRows;
+    const Row* rows = &rowSet.rows[begin];
+    for (size_t i = 0; i < trainer.features.size(); ++i) {
+        const uint8_t* bins = rowSet.bins[i];
+        uint8_t* localBins = trainer.localBins[i].data();
+        for (long j = 0; j < size; ++j) localBins[j] = bins[rows[j]];
+    }
+    for (long j = 0; j < size; ++j) {
+        trainer.localLabels[j] = rowSet.labels[rows[j]];
+        local.rows[j] = j;
+    }
+}
+
+// Function to build the decision tree recursively from histograms.
+// The node is the one on the given side at the given depth of the current path, covering rows from position begin;
+// histogram is the id of its cached histogram, or -1 if it has to be built.
+template <typename Row>
+Node* buildTreeHistogramNode(HistogramTrainer& trainer, RowSet<Row>& rowSet, int depth, int side, long begin, int histogram) {
+    ensureDepth(trainer, depth + 1);
+    int numClasses = trainer.numClasses;
+    NodeStats<long> stats = makeNodeStats(trainer.nodeCounts[depth][side].data(), numClasses);
+
+    // If all data points have the same class label, create a leaf node
+    int majorityClass = max_element(stats.classCounts, stats.classCounts + numClasses) - stats.classCounts;
+    if (stats.classCounts[majorityClass] == stats.size || trainer.features.empty()) {
+        releaseHistogram(trainer, histogram);
+        trainer.leafCounts.push_back(stats.size);
+        return new Node(majorityClass);
+    }
+
+    // Continue a small enough subtree on the local row set, with 16-bit row indices
+    if (sizeof(Row) > sizeof(uint16_t) && stats.size <= HistogramTrainer::localRowLimit && reserveLocalRows(trainer)) {
+        gatherLocalRows(trainer, rowSet, begin, stats.size);
+        return buildTreeHistogramNode(trainer, trainer.localRows, depth, side, 0, histogram);
+    }
+
+    // Build the node's histogram unless it was derived by the parent; use the scratch buffer if the cache is full
+    if (histogram == -1) {
+        histogram = acquireHistogram(trainer);
+        if (histogram == -1) histogram = 0;
+        buildHistogram(trainer, rowSet, histogram, begin, begin + stats.size);
+    }
+
+    // Find the best split; without any candidate create a majority leaf
+    long* leftCounts = trainer.nodeCounts[depth + 1][0].data();
+    long* rightCounts = trainer.nodeCounts[depth + 1][1].data();
+    int splitFeature = -1, splitBin = -1;
+    SplitResult bestSplit = findBestSplitHistogram(trainer, trainer.histograms[histogram].data(), stats, leftCounts, splitFeature, splitBin);
+    if (bestSplit.featureIndex == -1) {
+        releaseHistogram(trainer, histogram);
+        trainer.leafCounts.push_back(stats.size);
+        return new Node(majorityClass);
+    }
+    for (int c = 0; c < numClasses; ++c) {
+        rightCounts[c] = stats.classCounts[c] - leftCounts[c];
+    }
+    long numLeft = partitionBinnedRows(rowSet, begin, begin + stats.size, splitFeature, splitBin);
+    long numRight = stats.size - numLeft;
+
+    // Build the smaller child's histogram and derive the larger child's in this node's buffer, if both can be cached
+    int leftHistogram = -1, rightHistogram = -1;
+    int smallHistogram = histogram > 0 ? acquireHistogram(trainer) : -1;
+    if (smallHistogram != -1) {
+        if (numLeft <= numRight) {
+            buildHistogram(trainer, rowSet, smallHistogram, begin, begin + numLeft);
+            leftHistogram = smallHistogram;
+            rightHistogram = histogram;
+        } else {
+            buildHistogram(trainer, rowSet, smallHistogram, begin + numLeft, begin + stats.size);
+            leftHistogram = histogram;
+            rightHistogram = smallHistogram;
+        }
+        subtractHistogram(trainer, histogram, smallHistogram);
+    } else {
+        releaseHistogram(trainer, histogram);
+    }
+
+    // Recursively build the left and right subtrees
+    Node* leftChild = buildTreeHistogramNode(trainer, rowSet, depth + 1, 0, begin, leftHistogram);
+    Node* rightChild = buildTreeHistogramNode(trainer, rowSet, depth + 1, 1, begin + numLeft, rightHistogram);
+
+    return new Node(bestSplit.featureIndex, bestSplit.splitValue, leftChild, rightChild);
+}
+
+// Function to build the decision tree from a prepared histogram trainer
+Node* buildTreeHistogram(HistogramTrainer& trainer) {
+    ensureDepth(trainer, 0);
+    for (int label : trainer.labels) {
+        trainer.nodeCounts[0][0][label]++;
+    }
+    if (!trainer.wideRows.rows.empty()) {
+        return buildTreeHistogramNode(trainer, trainer.wideRows, 0, 0, 0, -1);
+    }
+    return buildTreeHistogramNode(trainer, trainer.narrowRows, 0, 0, 0, -1);
+}
+
+// Function to build the decision tree with the histogram engine, on at most options.maxBins bins per feature.
+// If leafCounts is given, it receives the number of training rows of every leaf in preorder.
+Node* buildTreeHistogram(const ColumnStore& store, const vector<int>& features, const TrainingOptions& options,
+                         vector<uint64_t>* leafCounts = nullptr) {
+    HistogramTrainer trainer(store, features, options);
+    Node* root = buildTreeHistogram(trainer);
+    if (leafCounts != nullptr) leafCounts->swap(trainer.leafCounts);
+    return root;
+}
+
+// Function to apply the memory options to the memory account. Call it before loading a dataset, so that the loaders
+// spill the blocks that do not fit in the limit as well.
+void configureMemory(const TrainingOptions& options) {
+    memoryAccount.limit = options.memoryLimit;
+    memoryAccount.hugePages = options.hugePages;
+    memoryAccount.interleaveNodes = options.numaPolicy == TrainingOptions::NumaInterleave;
+    memoryAccount.spillToDisk = false;
+}
+
+// Function to count the bytes of a dataset block held in memory, which are 0 once it is spilled to disk
+template <typename T>
+long heldBytes(const DatasetVector<T>& block) {
+    return block.empty() || isSpilledBlock(block.data()) ? 0 : block.capacity() * sizeof(T);
+}
+
+// Function to train a decision tree on a column store within the memory limit of the options.
+// If binMapper is given, it receives the bin boundaries the tree was trained on; it is left empty for exact training.
+// If leafCounts is given, it receives the number of training rows of every leaf in preorder, as saveModel takes them.
+// The exact presorted engine is used when it fits. Otherwise the histogram engine is used with the most bins whose
+// histograms fit once the store's raw columns are released, and the dataset is spilled to disk when even the binned
+// columns would not fit. Under a limit, the bin boundaries are sketched rather than sorted from copies of the columns.
+// The raw columns are only released when the budget requires it or the dataset spills, and then each one as soon as
+// it is binned; a bin column that does not fit beside the raw columns still held is spilled. Histograms are only
+// cached while they fit. Sparse datasets are always binned, and datasets quantized while loading are trained on their
+// own bins.
+Node* trainTree(ColumnStore& store, const vector<int>& features, TrainingOptions options, BinMapper* binMapper = nullptr,
+                vector<uint64_t>* leafCounts = nullptr) {
+    configureMemory(options);
+    long numDataPoints = store.numRows;
+    long numActive = features.size();
+    long numClasses = store.numClasses;
+
+    long presortedBytes = numActive * numDataPoints * (sizeof(int) + sizeof(double) + numClasses * sizeof(int))
+                        + max(options.numThreads, 1) * numDataPoints
+                          * (2 * sizeof(int) + (options.exactScoring ? 0 : (numClasses + 2) * sizeof(int) + sizeof(double)));
+    bool numaPartition = options.numaPolicy == TrainingOptions::NumaPartition; // Only the histogram engine partitions rows
+    bool narrowRows = numDataPoints <= numeric_limits<int>::max(); // The presorted engine has 32-bit row indices
+    if (options.maxBins == 0 && !numaPartition && narrowRows && !store.isSparse() && !store.isBinned() && fitsInMemory(presortedBytes)) {
+        if (binMapper != nullptr) *binMapper = BinMapper();
+        return buildTreePresorted(store, features, options, nullptr, leafCounts);
+    }
+
+    // Raw columns held in memory that binning makes unnecessary, and which can be released if the budget requires it
+    long releasableBytes = 0;
+    if (!store.isBinned()) {
+        for (const DatasetVector<double>& column : store.ownedColumns) releasableBytes += heldBytes(column);
+        releasableBytes += heldBytes(store.sparseColumns.offsets) + heldBytes(store.sparseColumns.indices) + heldBytes(store.sparseColumns.values);
+    }
+    auto fitsAfterRelease = [releasableBytes](long bytes) { return fitsInMemory(bytes - releasableBytes); };
+
+    // The binned columns and the row indices must fit, otherwise the binned columns go to disk as well
+    long columnBytes = store.isBinned() ? 0 : numActive * numDataPoints * sizeof(uint8_t);
+    long rowBytes = 2 * numDataPoints * (numDataPoints > numeric_limits<uint32_t>::max() ? sizeof(uint64_t) : sizeof(uint32_t));
+    if (!fitsAfterRelease(columnBytes + rowBytes)) {
+        memoryAccount.spillToDisk = true;
+        columnBytes = 0;
+    }
+
+    // Use the most bins for which the scratch histogram and at least one cached one fit; a dataset quantized while
+    // loading keeps its bins
+    int maxBins = store.isBinned() ? store.binMapper.maxBins : options.maxBins > 0 ? min(options.maxBins, 256) : 256;
+    while (!store.isBinned() && maxBins > 2 && !fitsAfterRelease(columnBytes + rowBytes + 2 * numActive * maxBins * numClasses * sizeof(long))) {
+        maxBins = max(maxBins / 4, 2);
+    }
+    options.maxBins = maxBins;
+    if (options.memoryLimit > 0 && options.sketchSize == 0) options.sketchSize = limitedSketchSize;
+    // Release the raw columns when the budget requires it, and when spilling, where they would only add resident pages
+    bool releaseColumns = !store.isBinned() && (memoryAccount.spillToDisk || (releasableBytes > 0
+                          && !fitsInMemory(columnBytes + rowBytes + 2 * numActive * maxBins * numClasses * sizeof(long))));
+    if (options.memoryLimit > 0) {
+        clog << "Training with the histogram engine on " << maxBins << " bins"
+             << (memoryAccount.spillToDisk ? ", spilling large dataset blocks to disk" : "") << endl;
+    }
+
+    HistogramTrainer trainer(store, features, options, releaseColumns ? &store : nullptr);
+    if (binMapper != nullptr) *binMapper = trainer.mapper;
+    if (releaseColumns) {
+        vector<DatasetVector<double>>().swap(store.ownedColumns); // The rest of the raw columns, not needed once binned
+        store.columns.clear();
+        store.sparseColumns = SparseMatrix();
+    }
+    Node* root = buildTreeHistogram(trainer);
+    if (leafCounts != nullptr) leafCounts->swap(trainer.leafCounts);
+    return root;
+}
+
+// Function to train a decision tree on a row-major dataset within the memory limit of the options.
+// The columns of the column store that do not fit are spilled to disk.
+Node* trainTree(const vector<vector<double>>& dataset, const vector<int>& features, TrainingOptions options, BinMapper* binMapper = nullptr,
+                vector<uint64_t>* leafCounts = nullptr) {
+    configureMemory(options);
+    ColumnStore store = buildColumnStore(dataset);
+    return trainTree(store, features, options, binMapper, leafCounts);
+}
+
+// Function to free a tree, with an explicit stack since a tree read from a file may be arbitrarily deep
+void deleteTree(Node* node) {
+    vector<Node*> pending = {node};
+    while (!pending.empty()) {
+        node = pending.back();
+        pending.pop_back();
+        if (node == nullptr) continue;
+        pending.push_back(node->left);
+        pending.push_back(node->right);
+        delete node;
+    }
+}
+
+// Function to write a value in the native binary representation
+template <typename T>
+void writeBinary(ostream& out, T value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Function to read a value in the native binary representation; returns false at the end of the stream
+template <typename T>
+bool readBinary(istream& in, T& value) {
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+// Function to write a tree in preorder: for every node its feature index, then the split value of a split or the
+// class label of a leaf (feature index -1)
+void writeTree(ostream& out, const Node* node) {
+    writeBinary<int32_t>(out, node->featureIndex);
+    writeBinary<double>(out, node->featureIndex == -1 ? node->classLabel : node->splitValue);
+    if (node->featureIndex != -1) {
+        writeTree(out, node->left);
+        writeTree(out, node->right);
+    }
+}
+
+// Deepest tree a model file may describe. The functions walking a tree recurse like the trainers that grew it, so a
+// deeper tree from a corrupt file would exhaust the call stack after loading.
+const int maxModelDepth = 1 << 16;
+
+// Function to read a tree written by writeTree; returns nullptr if the stream ends early, the tree is deeper than
+// maxModelDepth, or a split tests a feature below 0, or at or past numFeatures if that is given. The nodes are read
+// with an explicit stack of the child links still to fill and their depths.
+Node* readTree(istream& in, int numFeatures = 0) {
+    Node* root = nullptr;
+    vector<pair<Node**, int>> pendingLinks = {{&root, 0}};
+    while (!pendingLinks.empty()) {
+        Node** link = pendingLinks.back().first;
+        int depth = pendingLinks.back().second;
+        pendingLinks.pop_back();
+        int32_t featureIndex;
+        double value;
+        if (!readBinary(in, featureIndex) || !readBinary(in, value) || featureIndex < -1
+            || (numFeatures > 0 && featureIndex >= numFeatures) || (featureIndex != -1 && depth >= maxModelDepth)) {
+            deleteTree(root);
+            return nullptr;
+        }
+        if (featureIndex == -1) {
+            *link = new Node(value);
+            continue;
+        }
+        *link = new Node(featureIndex, value, nullptr, nullptr);
+        pendingLinks.push_back({&(*link)->right, depth + 1});
+        pendingLinks.push_back({&(*link)->left, depth + 1});
+    }
+    return root;
+}
+
+// Function to count the bytes left to read in a file stream
+long remainingBytes(istream& in) {
+    streampos position = in.tellg();
+    in.seekg(0, ios::end);
+    long remaining = in.tellg() - position;
+    in.seekg(position);
+    return remaining;
+}
+
+// Function to write a bin mapper: the number of features and maxBins, then the boundaries of every feature preceded by
+// their count
+void writeBinMapper(ostream& out, const BinMapper& mapper) {
+    writeBinary<int32_t>(out, mapper.boundaries.size());
+    writeBinary<int32_t>(out, mapper.maxBins);
+    for (const vector<double>& boundaries : mapper.boundaries) {
+        writeBinary<int32_t>(out, boundaries.size());
+        out.write(reinterpret_cast<const char*>(boundaries.data()), boundaries.size() * sizeof(double));
+    }
+}
+
+// Function to read a bin mapper written by writeBinMapper; returns false if the stream ends early or a count is out
+// of range. The number of features is checked against the remaining length before anything is allocated for it.
+bool readBinMapper(istream& in, BinMapper& mapper) {
+    int32_t numFeatures, maxBins;
+    if (!readBinary(in, numFeatures) || !readBinary(in, maxBins) || numFeatures < 0
+        || numFeatures > remainingBytes(in) / static_cast<long>(sizeof(int32_t))) {
+        return false;
+    }
+    mapper.maxBins = maxBins;
+    mapper.boundaries.assign(numFeatures, vector<double>());
+    for (vector<double>& boundaries : mapper.boundaries) {
+        int32_t count;
+        if (!readBinary(in, count) || count < 0 || count > 255) return false;
+        boundaries.resize(count);
+        if (!in.read(reinterpret_cast<char*>(boundaries.data()), count * sizeof(double))) return false;
+    }
+    return true;
+}
+
+// Tag at the start of a model file; the last character is the format version
+const char modelMagic[8] = {'C', 'A', 'R', 'T', 'M', 'D', 'L', '2'};
+
+// Function to save a tree with the bin mapper it was trained on and the number of training rows that reached each of
+// its leaves (in preorder): the tag, the number of features and maxBins, the boundaries of every feature preceded by
+// their count, the tree, and the leaf counts preceded by their number. An exactly trained tree has no boundaries,
+// and leafCounts may be empty when the training rows were not counted. Returns false if the file cannot be written.
+bool saveModel(const string& path, const Node* root, const BinMapper& mapper, const vector<uint64_t>& leafCounts = {}) {
+    ofstream out(path, ios::binary);
+    out.write(modelMagic, sizeof(modelMagic));
+    writeBinMapper(out, mapper);
+    writeTree(out, root);
+    writeBinary<int64_t>(out, leafCounts.size());
+    out.write(reinterpret_cast<const char*>(leafCounts.data()), leafCounts.size() * sizeof(uint64_t));
+    return static_cast<bool>(out);
+}
+
+// Function to load a model saved by saveModel, and its leaf counts if leafCounts is given (empty for version 1
+// files, which have none); returns false if the file cannot be read or is not a model. Counts read from the file
+// are checked against its remaining length before anything is allocated for them, so a corrupt file fails cleanly.
+bool loadModel(const string& path, Node*& root, BinMapper& mapper, vector<uint64_t>* leafCounts = nullptr) {
+    ifstream in(path, ios::binary);
+    char magic[sizeof(modelMagic)];
+    if (!in.read(magic, sizeof(magic)) || !equal(magic, magic + sizeof(magic) - 1, modelMagic)
+        || (magic[sizeof(magic) - 1] != '1' && magic[sizeof(magic) - 1] != '2') || !readBinMapper(in, mapper)) {
+        return false;
+    }
+    root = readTree(in, mapper.boundaries.size());
+    if (root == nullptr) return false;
+    int64_t numLeaves = 0;
+    if (magic[sizeof(magic) - 1] != '1'
+        && (!readBinary(in, numLeaves) || numLeaves < 0 || numLeaves > remainingBytes(in) / static_cast<long>(sizeof(uint64_t)))) {
+        deleteTree(root);
+        return false;
+    }
+    vector<uint64_t> counts(numLeaves);
+    if (!in.read(reinterpret_cast<char*>(counts.data()), numLeaves * sizeof(uint64_t))) {
+        deleteTree(root);
+        return false;
+    }
+    if (leafCounts != nullptr) leafCounts->swap(counts);
+    return true;
+}
+
+// Structure to represent a node of a tree compiled for binned inference. The nodes are stored in preorder, so the
+// left child of a split directly follows it.
+struct BinnedNode {
+    int featureIndex;  // -1 for a leaf
+    int splitBin;      // Rows whose bin id of the feature is at most this go left
+    int rightChild;    // Index of the right child
+    double classLabel; // Class of a leaf
+};
+
+// Function to compile a subtree for binned inference, appending its nodes in preorder.
+// Returns false if a split value is not one of the mapper's boundaries, as in exactly trained trees.
+bool compileBinnedTree(const Node* node, const BinMapper& mapper, vector<BinnedNode>& nodes) {
+    nodes.push_back({node->featureIndex, 0, 0, node->classLabel});
+    if (node->featureIndex == -1) return true;
+    size_t index = nodes.size() - 1;
+    if (node->featureIndex < 0 || node->featureIndex >= static_cast<int>(mapper.boundaries.size())) return false;
+
+    // A value is below the boundary b exactly when its bin id is at most b
+    const vector<double>& boundaries = mapper.boundaries[node->featureIndex];
+    vector<double>::const_iterator boundary = lower_bound(boundaries.begin(), boundaries.end(), node->splitValue);
+    if (boundary == boundaries.end() || *boundary != node->splitValue) return false;
+    nodes[index].splitBin = boundary - boundaries.begin();
+    if (!compileBinnedTree(node->left, mapper, nodes)) return false;
+    nodes[index].rightChild = nodes.size();
+    return compileBinnedTree(node->right, mapper, nodes);
+}
+
+// Function to quantize the rows [begin, end) of a column store to bin ids, row by row with one byte per feature of
+// the mapper. Features without boundaries get bin 0.
+void binRows(const BinMapper& mapper, const ColumnStore& store, long begin, long end, uint8_t* bins) {
+    int numFeatures = mapper.boundaries.size();
+    for (int featureIndex = 0; featureIndex < numFeatures; ++featureIndex) {
+        const vector<double>& boundaries = mapper.boundaries[featureIndex];
+        for (long row = begin; row < end; ++row) {
+            bins[(row - begin) * numFeatures + featureIndex] = boundaries.empty() ? 0 : findBin(boundaries, store.columns[featureIndex][row]);
+        }
+    }
+}
+
+// Function to classify a quantized row with a compiled tree
+double classifyBinned(const vector<BinnedNode>& tree, const uint8_t* rowBins) {
+    int index = 0;
+    while (tree[index].featureIndex != -1) {
+        const BinnedNode& node = tree[index];
+        index = rowBins[node.featureIndex] <= node.splitBin ? index + 1 : node.rightChild;
+    }
+    return tree[index].classLabel;
+}
+
+// Function to classify every row of a column store with trees compiled against the same bin mapper, on the workers
+// of a pool. The rows are quantized once, a block at a time, and all trees traverse the block's bin ids.
+// Returns predictions[tree][row].
+vector<vector<double>> classifyBinnedBatch(const vector<vector<BinnedNode>>& trees, const BinMapper& mapper, const ColumnStore& store, ThreadPool& pool) {
+    const long blockRows = 256;
+    int numFeatures = mapper.boundaries.size();
+    vector<vector<double>> predictions(trees.size(), vector<double>(store.numRows));
+    vector<vector<uint8_t>> workerBins(pool.size(), vector<uint8_t>(blockRows * numFeatures));
+    forEachRowChunk(pool, store.numRows, trees.empty() ? nullptr : predictions[0].data(), [&](int worker, long chunkBegin, long chunkEnd) {
+        uint8_t* bins = workerBins[worker].data();
+        for (long begin = chunkBegin; begin < chunkEnd; begin += blockRows) {
+            long end = min(begin + blockRows, chunkEnd);
+            binRows(mapper, store, begin, end, bins);
+            for (size_t tree = 0; tree < trees.size(); ++tree) {
+                for (long row = begin; row < end; ++row) {
+                    predictions[tree][row] = classifyBinned(trees[tree], &bins[(row - begin) * numFeatures]);
+                }
+            }
+        }
+    });
+    return predictions;
+}
+
+// Function to append an unsigned LEB128 varint: 7 bits per byte, low bits first, the high bit set on all but the last
+void writeVarint(string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+// Function to read a varint, advancing position past it; returns false if the data ends within it or it is too long
+bool readVarint(const uint8_t*& position, const uint8_t* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && position < end; shift += 7) {
+        uint8_t byte = *position++;
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+// Tag and version at the start of a compact tree
+const char compactTreeMagic[3] = {'C', 'T', 1};
+
+// Function to encode a compiled tree compactly for storage and transfer: the tag, the number of nodes as a varint,
+// and the nodes in preorder. A split is its feature index + 1 as a varint and its split bin as one byte; a leaf is a
+// 0 byte and its class as a varint. The thresholds are thus indices into the boundaries of the mapper the tree was
+// compiled against, which is shipped once for all trees sharing it. No child offsets are stored: the left child
+// follows its parent and the right child follows the left subtree.
+string encodeBinnedTree(const vector<BinnedNode>& tree) {
+    string out(compactTreeMagic, sizeof(compactTreeMagic));
+    writeVarint(out, tree.size());
+    for (const BinnedNode& node : tree) {
+        if (node.featureIndex == -1) {
+            out.push_back(0);
+            writeVarint(out, static_cast<uint64_t>(node.classLabel));
+        } else {
+            writeVarint(out, node.featureIndex + 1);
+            out.push_back(static_cast<char>(node.splitBin));
+        }
+    }
+    return out;
+}
+
+// Function to decode a compact tree compiled against a bin mapper into the flat inference layout in one pass. The
+// splits whose right child has not been reached yet are kept on a stack: the node after a leaf is the right child of
+// the innermost of them. Returns false if the data is not exactly one compact tree, or if a split tests a feature or
+// a bin the mapper does not have, which binned inference would read past the row's bins for.
+bool decodeBinnedTree(const string& data, const BinMapper& mapper, vector<BinnedNode>& tree) {
+    if (data.compare(0, sizeof(compactTreeMagic), compactTreeMagic, sizeof(compactTreeMagic)) != 0) return false;
+    const uint8_t* position = reinterpret_cast<const uint8_t*>(data.data()) + sizeof(compactTreeMagic);
+    const uint8_t* end = reinterpret_cast<const uint8_t*>(data.data()) + data.size();
+    uint64_t numNodes;
+    if (!readVarint(position, end, numNodes) || numNodes == 0 || numNodes > data.size() / 2) return false;
+
+    tree.clear();
+    tree.reserve(numNodes);
+    vector<int> pendingSplits;
+    for (uint64_t i = 0; i < numNodes; ++i) {
+        uint64_t tag, value;
+        if (!readVarint(position, end, tag)) return false;
+        if (tag == 0) {
+            if (!readVarint(position, end, value)) return false;
+            tree.push_back({-1, 0, 0, static_cast<double>(value)});
+            if (pendingSplits.empty()) {
+                if (i + 1 != numNodes) return false; // The tree is complete before its last node
+                continue;
+            }
+            tree[pendingSplits.back()].rightChild = tree.size();
+            pendingSplits.pop_back();
+        } else {
+            if (position == end || tag > mapper.boundaries.size() || *position >= mapper.boundaries[tag - 1].size()) return false;
+            tree.push_back({static_cast<int>(tag - 1), *position++, 0, -1.0});
+            pendingSplits.push_back(tree.size() - 1);
+        }
+    }
+    return pendingSplits.empty() && position == end;
+}
+
+// Tag at the start of a file of compact trees; the last character is the format version
+const char compactFileMagic[8] = {'C', 'A', 'R', 'T', 'C', 'P', 'T', '1'};
+
+// Function to save trees compiled against the same bin mapper for shipping: the tag, the mapper as in a model file,
+// the number of trees, and every tree as encodeBinnedTree encodes it, preceded by its length. Returns false if the
+// file cannot be written.
+bool saveCompactTrees(const string& path, const BinMapper& mapper, const vector<vector<BinnedNode>>& trees) {
+    ofstream out(path, ios::binary);
+    out.write(compactFileMagic, sizeof(compactFileMagic));
+    writeBinMapper(out, mapper);
+    writeBinary<int32_t>(out, trees.size());
+    for (const vector<BinnedNode>& tree : trees) {
+        string encoded = encodeBinnedTree(tree);
+        writeBinary<int64_t>(out, encoded.size());
+        out.write(encoded.data(), encoded.size());
+    }
+    return static_cast<bool>(out);
+}
+
+// Function to load a file saved by saveCompactTrees, decoding every tree into the flat inference layout; returns false
+// if the file cannot be read, is not a file of compact trees, or a tree does not decode against its mapper
+bool loadCompactTrees(const string& path, BinMapper& mapper, vector<vector<BinnedNode>>& trees) {
+    ifstream in(path, ios::binary);
+    char magic[sizeof(compactFileMagic)];
+    int32_t numTrees;
+    if (!in.read(magic, sizeof(magic)) || !equal(magic, magic + sizeof(magic), compactFileMagic) || !readBinMapper(in, mapper)
+        || !readBinary(in, numTrees) || numTrees < 0 || numTrees > remainingBytes(in) / static_cast<long>(sizeof(int64_t))) {
+        return false;
+    }
+    trees.assign(numTrees, vector<BinnedNode>());
+    for (vector<BinnedNode>& tree : trees) {
+        int64_t size;
+        if (!readBinary(in, size) || size < 0 || size > remainingBytes(in)) return false;
+        string encoded(size, '\0');
+        if (!in.read(&encoded[0], size) || !decodeBinnedTree(encoded, mapper, tree)) return false;
+    }
+    return true;
+}
+
+// Function to score a column store with the trees of saved models and of files of compact trees, which must all
+// share one bin mapper: every row is binned once, and all trees traverse its bin ids. Prints the accuracy of every
+// tree on the store's labels and the time per row. Returns false, saying why, if a file cannot be loaded, a model was
+// not trained on bins, the mappers differ, or the store has no dense column for every binned feature.
+bool scoreBinnedModels(const vector<string>& paths, const ColumnStore& store, int numThreads, ostream& out) {
+    typedef chrono::steady_clock Clock;
+    BinMapper mapper;
+    vector<vector<BinnedNode>> trees;
+    for (const string& path : paths) {
+        BinMapper fileMapper;
+        vector<vector<BinnedNode>> fileTrees;
+        Node* model = nullptr;
+        if (!loadCompactTrees(path, fileMapper, fileTrees)) {
+            fileTrees.assign(1, vector<BinnedNode>());
+            if (!loadModel(path, model, fileMapper)) {
+                out << "Cannot load " << path << endl;
+                return false;
+            }
+            bool compiled = compileBinnedTree(model, fileMapper, fileTrees[0]);
+            deleteTree(model);
+            if (!compiled) {
+                out << "The model " << path << " was not trained on bins" << endl;
+                return false;
+            }
+        }
+        if (trees.empty()) {
+            mapper = fileMapper;
+        } else if (fileMapper.boundaries != mapper.boundaries) {
+            out << "The bins of " << path << " differ from those of " << paths[0] << endl;
+            return false;
+        }
+        trees.insert(trees.end(), fileTrees.begin(), fileTrees.end());
+    }
+    if (store.isSparse() || store.isBinned() || store.columns.size() < mapper.boundaries.size()) {
+        out << "Scoring needs the dense columns of every binned feature, which sparse, pipelined or memory-limited loading drops" << endl;
+        return false;
+    }
+
+    ThreadPool pool(numThreads);
+    Clock::time_point start = Clock::now();
+    vector<vector<double>> predictions = classifyBinnedBatch(trees, mapper, store, pool);
+    double seconds = chrono::duration<double>(Clock::now() - start).count();
+    for (size_t tree = 0; tree < trees.size(); ++tree) {
+        long correct = 0;
+        for (long row = 0; row < store.numRows; ++row) correct += predictions[tree][row] == store.labels[row];
+        out << "Tree " << tree << " (" << trees[tree].size() << " nodes): accuracy " << static_cast<double>(correct) / max(store.numRows, 1L) << endl;
+    }
+    out << "Scored " << store.numRows << " rows with " << trees.size() << " trees on one binning pass in "
+        << seconds * 1e9 / max(store.numRows, 1L) << " ns/row" << endl;
+    return true;
+}
+
+// Structure to represent a node of a tree with integer thresholds. Packed, so that a node takes 7 bytes with 8-bit
+// codes and 8 with 16-bit ones; x86 reads the unaligned child index at no extra cost.
+template <typename Code>
+struct __attribute__((packed)) QuantizedNode {
+    int16_t featureIndex; // -1 for a leaf
+    Code threshold;       // Rows whose code of the feature is below this go left
+    int32_t rightChild;   // Index of the right child; the class of a leaf
+};
+
+// Structure to hold a tree whose thresholds are codes of type Code, in preorder (the left child of a split follows it).
+// A value x of feature f has as code its rank among the distinct split values of f, the number of them at or below x.
+// A split on the value thresholds[f][i] then has threshold i + 1, and sends exactly the same values left.
+template <typename Code>
+struct QuantizedTree {
+    vector<QuantizedNode<Code>> nodes;
+    vector<vector<double>> thresholds; // thresholds[featureIndex]: distinct split values in ascending order
+};
+
+// Function to compute the code of a value of a feature
+template <typename Code>
+Code quantizeValue(const QuantizedTree<Code>& tree, int featureIndex, double value) {
+    const vector<double>& thresholds = tree.thresholds[featureIndex];
+    return static_cast<Code>(upper_bound(thresholds.begin(), thresholds.end(), value) - thresholds.begin());
+}
+
+// Function to collect the split values of a tree per feature; returns false if it tests a feature past thresholds
+bool collectThresholds(const Node* node, vector<vector<double>>& thresholds) {
+    if (node->featureIndex == -1) return true;
+    if (node->featureIndex >= static_cast<int>(thresholds.size())) return false;
+    thresholds[node->featureIndex].push_back(node->splitValue);
+    return collectThresholds(node->left, thresholds) && collectThresholds(node->right, thresholds);
+}
+
+// Function to append the nodes of a subtree to a quantized tree in preorder
+template <typename Code>
+void appendQuantizedNodes(const Node* node, QuantizedTree<Code>& tree) {
+    if (node->featureIndex == -1) {
+        tree.nodes.push_back({-1, 0, static_cast<int32_t>(node->classLabel)});
+        return;
+    }
+    size_t index = tree.nodes.size();
+    const vector<double>& thresholds = tree.thresholds[node->featureIndex];
+    Code threshold = lower_bound(thresholds.begin(), thresholds.end(), node->splitValue) - thresholds.begin() + 1;
+    tree.nodes.push_back({static_cast<int16_t>(node->featureIndex), threshold, 0});
+    appendQuantizedNodes(node->left, tree);
+    tree.nodes[index].rightChild = tree.nodes.size();
+    appendQuantizedNodes(node->right, tree);
+}
+
+// Function to quantize the rows [begin, end) of a column store to codes, row by row with one code per feature.
+// Features the tree does not test get code 0.
+template <typename Code>
+void quantizeRows(const QuantizedTree<Code>& tree, const ColumnStore& store, long begin, long end, Code* codes) {
+    int numFeatures = tree.thresholds.size();
+    for (int featureIndex = 0; featureIndex < numFeatures; ++featureIndex) {
+        if (tree.thresholds[featureIndex].empty()) {
+            for (long row = begin; row < end; ++row) codes[(row - begin) * numFeatures + featureIndex] = 0;
+            continue;
+        }
+        for (long row = begin; row < end; ++row) {
+            codes[(row - begin) * numFeatures + featureIndex] = quantizeValue(tree, featureIndex, store.columns[featureIndex][row]);
+        }
+    }
+}
+
+// Function to classify a quantized row with a quantized tree
+template <typename Code>
+double classifyQuantized(const QuantizedTree<Code>& tree, const Code* rowCodes) {
+    const QuantizedNode<Code>* nodes = tree.nodes.data();
+    int index = 0;
+    while (nodes[index].featureIndex != -1) {
+        index = rowCodes[nodes[index].featureIndex] < nodes[index].threshold ? index + 1 : nodes[index].rightChild;
+    }
+    return nodes[index].rightChild;
+}
+
+// Function to classify every row of a column store with a quantized tree, quantizing each row once
+template <typename Code>
+vector<double> classifyQuantizedBatch(const QuantizedTree<Code>& tree, const ColumnStore& store) {
+    const long blockRows = 256;
+    int numFeatures = tree.thresholds.size();
+    vector<double> predictions(store.numRows);
+    vector<Code> codes(blockRows * numFeatures);
+    for (long begin = 0; begin < store.numRows; begin += blockRows) {
+        long end = min(begin + blockRows, store.numRows);
+        quantizeRows(tree, store, begin, end, codes.data());
+        for (long row = begin; row < end; ++row) {
+            predictions[row] = classifyQuantized(tree, &codes[(row - begin) * numFeatures]);
+        }
+    }
+    return predictions;
+}
+
+// Function to convert a tree to integer thresholds of type Code (uint8_t or uint16_t), given data to check it on.
+// Rank codes are exact whenever every feature has fewer distinct split values than the top code of Code, so the
+// check that both trees classify the store alike is only a sanity check.
+// Returns false if a feature has too many split values (try wider codes), if the tree has more features than int16_t
+// indexes, or if the store has no dense column for every feature the tree tests (sparse and binned stores have none).
+template <typename Code>
+bool quantizeTree(const Node* root, const ColumnStore& store, QuantizedTree<Code>& tree) {
+    int numFeatures = store.columns.size();
+    if (store.isSparse() || store.isBinned() || numFeatures > numeric_limits<int16_t>::max()) return false;
+    tree.thresholds.assign(numFeatures, vector<double>());
+    if (!collectThresholds(root, tree.thresholds)) return false;
+    for (vector<double>& thresholds : tree.thresholds) {
+        sort(thresholds.begin(), thresholds.end());
+        thresholds.erase(unique(thresholds.begin(), thresholds.end()), thresholds.end());
+        if (thresholds.size() >= numeric_limits<Code>::max()) return false;
+    }
+    tree.nodes.clear();
+    appendQuantizedNodes(root, tree);
+    return classifyQuantizedBatch(tree, store) == classifyBatch(root, store);
+}
+
+// Function to convert a tree to codes of type Code and print whether its predictions on the store agree, the size of
+// its nodes, and the time per row of quantized and of ordinary batch classification. Returns whether they agree.
+template <typename Code>
+bool reportQuantizedTree(const Node* root, const ColumnStore& store, ostream& out) {
+    typedef chrono::steady_clock Clock;
+    QuantizedTree<Code> tree;
+    bool exact = quantizeTree(root, store, tree);
+    out << 8 * sizeof(Code) << "-bit thresholds: ";
+    if (!exact) {
+        out << "too many split values per feature, or the store has no dense columns" << endl;
+        return false;
+    }
+    Clock::time_point start = Clock::now();
+    classifyQuantizedBatch(tree, store);
+    Clock::time_point quantized = Clock::now();
+    classifyBatch(root, store);
+    Clock::time_point classified = Clock::now();
+    out << tree.nodes.size() << " nodes of " << sizeof(QuantizedNode<Code>) << " B, "
+        << chrono::duration<double, nano>(quantized - start).count() / max(store.numRows, 1L) << " ns/row ("
+        << chrono::duration<double, nano>(classified - quantized).count() / max(store.numRows, 1L) << " ns/row unquantized)" << endl;
+    return true;
+}
+
+// Structure to count, while classifying live traffic, the visits to every node of a tree and the lengths of the
+// paths taken. Nodes are numbered in preorder, the order saveModel writes them in. Each shard is written by one
+// thread at a time (such as a pool worker) and starts on its own cache line, so counting needs no locks and causes
+// no false sharing; the counts are relaxed atomics, so they can be dumped while classification goes on.
+struct VisitCounters {
+    struct alignas(64) CounterLine {
+        atomic<uint64_t> counts[8];
+    };
+
+    vector<const Node*> nodes;  // nodes[id], in preorder
+    vector<int> rightChild;     // Id of the right child of each internal node; the left child of node id is id + 1
+    vector<int> depths;         // Depth of each node (0 for the root)
+    int maxDepth = 0;
+    int shardLines = 0;         // Cache lines per shard: visits of nodes 0 .. n - 1, then rows per path length 0 .. maxDepth
+    vector<CounterLine> lines;
+
+    VisitCounters(const Node* root, int numShards);
+
+    atomic<uint64_t>& counter(int shard, int index) { return lines[shard * shardLines + index / 8].counts[index % 8]; }
+    const atomic<uint64_t>& counter(int shard, int index) const { return lines[shard * shardLines + index / 8].counts[index % 8]; }
+    int numShards() const { return shardLines == 0 ? 0 : lines.size() / shardLines; }
+
+    // Adds one to a counter of a shard; only the thread owning the shard writes it, so no atomic increment is needed
+    void increment(int shard, int index) {
+        atomic<uint64_t>& count = counter(shard, index);
+        count.store(count.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    }
+
+    // Sum of a counter over all shards
+    uint64_t total(int index) const {
+        uint64_t sum = 0;
+        for (int shard = 0; shard < numShards(); ++shard) sum += counter(shard, index).load(memory_order_relaxed);
+        return sum;
+    }
+};
+
+// Function to number the nodes of a tree in preorder
+void numberNodes(const Node* node, int depth, VisitCounters& counters) {
+    int id = counters.nodes.size();
+    counters.nodes.push_back(node);
+    counters.rightChild.push_back(-1);
+    counters.depths.push_back(depth);
+    counters.maxDepth = max(counters.maxDepth, depth);
+    if (node->featureIndex == -1) return;
+    numberNodes(node->left, depth + 1, counters);
+    counters.rightChild[id] = counters.nodes.size();
+    numberNodes(node->right, depth + 1, counters);
+}
+
+VisitCounters::VisitCounters(const Node* root, int numShards) {
+    numberNodes(root, 0, *this);
+    shardLines = (nodes.size() + maxDepth + 1 + 7) / 8;
+    lines = vector<CounterLine>(numShards * shardLines); // Value-initialized, so every count starts at zero
+}
+
+// Function to classify a row, given value(featureIndex) for its features, counting the nodes it visits and its path
+// length in a shard
+template <typename Value>
+double classifyCounted(VisitCounters& counters, int shard, Value&& value) {
+    int id = 0;
+    for (;;) {
+        counters.increment(shard, id);
+        const Node* node = counters.nodes[id];
+        if (node->featureIndex == -1) break;
+        id = value(node->featureIndex) < node->splitValue ? id + 1 : counters.rightChild[id];
+    }
+    counters.increment(shard, counters.nodes.size() + counters.depths[id]);
+    return counters.nodes[id]->classLabel;
+}
+
+// Function to look up the value of a sparse matrix (row- or column-major) at a row and column; absent entries,
+// including those of columns past the last one, are 0
+double sparseValue(const SparseMatrix& matrix, long row, int column) {
+    long line = matrix.columnMajor ? column : row;
+    long key = matrix.columnMajor ? row : column;
+    if (line >= (matrix.columnMajor ? matrix.numColumns : matrix.numRows)) return 0.0;
+    const long* begin = &matrix.indices[0] + matrix.offsets[line];
+    const long* end = &matrix.indices[0] + matrix.offsets[line + 1];
+    const long* entry = lower_bound(begin, end, key);
+    return entry != end && *entry == key ? matrix.values[entry - &matrix.indices[0]] : 0.0;
+}
+
+// Function to classify every row of a column store with dense or sparse columns on the workers of a pool, each
+// counting into the shard of its worker index (so counters needs at least as many shards as the pool has workers)
+vector<double> classifyBatchCounted(VisitCounters& counters, const ColumnStore& store, ThreadPool& pool) {
+    vector<double> predictions(store.numRows);
+    forEachRowChunk(pool, store.numRows, predictions.data(), [&](int worker, long begin, long end) {
+        for (long row = begin; row < end; ++row) {
+            if (store.isSparse()) {
+                predictions[row] = classifyCounted(counters, worker, [&](int featureIndex) { return sparseValue(store.sparseColumns, row, featureIndex); });
+            } else {
+                predictions[row] = classifyCounted(counters, worker, [&](int featureIndex) { return store.columns[featureIndex][row]; });
+            }
+        }
+    });
+    return predictions;
+}
+
+// Function to print the visits of every node (feature and split value, or class label for leaves) and the number of
+// rows per path length, summed over the shards. Safe to call while other threads are counting.
+void dumpVisitCounters(const VisitCounters& counters, ostream& out) {
+    int numNodes = counters.nodes.size();
+    uint64_t rootVisits = counters.total(0);
+    out << "Node  Depth  Test  Visits  Fraction" << endl;
+    for (int id = 0; id < numNodes; ++id) {
+        const Node* node = counters.nodes[id];
+        uint64_t visits = counters.total(id);
+        out << id << "  " << counters.depths[id] << "  ";
+        if (node->featureIndex == -1) {
+            out << "leaf " << node->classLabel;
+        } else {
+            out << "x" << node->featureIndex << " < " << node->splitValue;
+        }
+        out << "  " << visits << "  " << (rootVisits > 0 ? static_cast<double>(visits) / rootVisits : 0.0) << endl;
+    }
+    double totalLength = 0;
+    out << "Path length  Rows" << endl;
+    for (int depth = 0; depth <= counters.maxDepth; ++depth) {
+        uint64_t rows = counters.total(numNodes + depth);
+        totalLength += static_cast<double>(depth) * rows;
+        if (rows > 0) out << depth << "  " << rows << endl;
+    }
+    out << "Mean path length: " << (rootVisits > 0 ? totalLength / rootVisits : 0.0) << endl;
+}
+
+// Function to collect the visits of the leaves of a tree, in preorder, summed over the shards
+vector<uint64_t> leafVisits(const VisitCounters& counters) {
+    vector<uint64_t> visits;
+    for (size_t id = 0; id < counters.nodes.size(); ++id) {
+        if (counters.nodes[id]->featureIndex == -1) visits.push_back(counters.total(id));
+    }
+    return visits;
+}
+
+// Function to count the rows of a column store that reach each leaf of a tree, in preorder, as saveModel stores them
+vector<uint64_t> countLeafVisits(const Node* root, const ColumnStore& store, int numThreads) {
+    ThreadPool pool(numThreads);
+    VisitCounters counters(root, pool.size());
+    classifyBatchCounted(counters, store, pool);
+    return leafVisits(counters);
+}
+
+// Structure to hold the divergence of a live leaf-occupancy distribution from the training-time one
+struct DriftScore {
+    double psi = 0; // Population stability index, sum (live - training) * ln(live / training)
+    double kl = 0;  // Kullback-Leibler divergence of the live distribution from the training one, in nats
+};
+
+// Function to compare the leaf occupancy of live traffic with that of the training rows (counts of the same leaves
+// in the same order). A leaf expected to hold m rows on the smaller side adds sampling noise of about 2/m to the PSI,
+// so deep trees with thousands of tiny leaves would cross any fixed threshold on identical traffic. Leaves expected to
+// hold at least minExpectedRows rows are therefore compared on their own, and only the smaller ones are pooled, runs of
+// neighbouring leaves in preorder until each pool expects that many (a short remainder joins the last group). With
+// the default of 100, noise stays near 0.02 however many leaves the tree has. Every group count gets half a row
+// added, so that groups one side never reached keep the scores finite.
+DriftScore leafDrift(const vector<uint64_t>& trainingCounts, const vector<uint64_t>& liveCounts, double minExpectedRows = 100) {
+    double trainingRows = 0, liveRows = 0;
+    for (size_t leaf = 0; leaf < trainingCounts.size(); ++leaf) {
+        trainingRows += trainingCounts[leaf];
+        liveRows += liveCounts[leaf];
+    }
+    // Rows a leaf is expected to hold on the smaller side, per training row
+    double expectedPerRow = trainingRows > 0 ? min(trainingRows, liveRows) / trainingRows : 0.0;
+
+    vector<double> trainingGroups, liveGroups;
+    double pooledTraining = 0, pooledLive = 0;
+    bool pooling = false;
+    for (size_t leaf = 0; leaf < trainingCounts.size(); ++leaf) {
+        if (trainingCounts[leaf] * expectedPerRow >= minExpectedRows) {
+            trainingGroups.push_back(trainingCounts[leaf]);
+            liveGroups.push_back(liveCounts[leaf]);
+            continue;
+        }
+        pooledTraining += trainingCounts[leaf];
+        pooledLive += liveCounts[leaf];
+        pooling = true;
+        if (pooledTraining * expectedPerRow >= minExpectedRows) {
+            trainingGroups.push_back(pooledTraining);
+            liveGroups.push_back(pooledLive);
+            pooledTraining = pooledLive = 0;
+            pooling = false;
+        }
+    }
+    if (pooling && !trainingGroups.empty()) {
+        trainingGroups.back() += pooledTraining;
+        liveGroups.back() += pooledLive;
+    } else if (pooling) {
+        trainingGroups.push_back(pooledTraining);
+        liveGroups.push_back(pooledLive);
+    }
+
+    double trainingTotal = trainingRows + 0.5 * trainingGroups.size(), liveTotal = liveRows + 0.5 * liveGroups.size();
+    DriftScore score;
+    for (size_t group = 0; group < trainingGroups.size(); ++group) {
+        double training = (trainingGroups[group] + 0.5) / trainingTotal;
+        double live = (liveGroups[group] + 0.5) / liveTotal;
+        score.psi += (live - training) * log(live / training);
+        score.kl += live * log(live / training);
+    }
+    return score;
+}
+
+// Function to score the drift of the traffic counted so far from the training-time leaf counts of the model, and
+// call retrain(score) if its PSI exceeds the threshold (0.2 is commonly read as a significant shift).
+// Returns the score; the caller decides when to check, e.g. every so many rows or on a timer.
+template <typename Retrain>
+DriftScore monitorDrift(const vector<uint64_t>& trainingCounts, const VisitCounters& live, double psiThreshold, Retrain&& retrain) {
+    DriftScore score = leafDrift(trainingCounts, leafVisits(live));
+    if (score.psi > psiThreshold) retrain(score);
+    return score;
+}
+
+// Structure to hold a rolling window of the latest rows of a time-ordered dataset, for retraining as it moves.
+// Rows live in slots of a fixed capacity; once the window is full, every new row takes the slot of the oldest one.
+// For the presorted engine (maxBins 0) the window keeps the dense columns and the slots of every feature in ascending
+// order of its values; for the histogram engine it keeps the bins of every row. Moving the window therefore only
+// sorts or bins the new rows and merges them in, rather than sorting or binning the whole window again.
+// The bin boundaries come from the first rows added and stay fixed; start a new window to refresh them (for instance
+// when leafDrift reports a shift).
+struct SlidingWindow {
+    ColumnStore store;               // The rows of the window, in slot order, with its labels
+    long capacity;
+    long oldestSlot = 0;             // Slot of the oldest row once the window is full
+    vector<vector<int>> sortedSlots; // sortedSlots[featureIndex]: slots in ascending order of the feature's values
+
+    SlidingWindow(int numFeatures, long capacity, int maxBins = 0);
+};
+
+SlidingWindow::SlidingWindow(int numFeatures, long capacity, int maxBins) : capacity(capacity) {
+    if (maxBins > 0) {
+        store.binMapper.maxBins = min(max(maxBins, 2), 256);
+        for (int j = 0; j < numFeatures; ++j) store.binnedColumns.emplace_back(capacity);
+        return;
+    }
+    for (int j = 0; j < numFeatures; ++j) store.ownedColumns.emplace_back(capacity);
+    for (int j = 0; j < numFeatures; ++j) store.columns.push_back(store.ownedColumns[j].data());
+    sortedSlots.resize(numFeatures);
+}
+
+// Function to move a window forward over the rows [begin, end) of a dense or sparse column store, oldest first.
+// The oldest rows of the window expire to make room; if there are more new rows than the window holds, only the
+// latest of them are added. Each feature costs a sort of the new rows and a linear merge with the window's order.
+void advanceWindow(SlidingWindow& window, const ColumnStore& source, long begin, long end) {
+    ColumnStore& store = window.store;
+    int numFeatures = store.isBinned() ? store.binnedColumns.size() : store.columns.size();
+    begin = max(begin, end - window.capacity);
+    auto value = [&source](long row, int featureIndex) {
+        return source.isSparse() ? sparseValue(source.sparseColumns, row, featureIndex) : source.columns[featureIndex][row];
+    };
+
+    // Give every new row a free slot or the oldest one, and copy its label and values there
+    vector<int> slots;
+    vector<char> isOverwritten(store.numRows, 0);
+    for (long row = begin; row < end; ++row) {
+        long slot;
+        if (store.numRows < window.capacity) {
+            slot = store.numRows++;
+            store.labels.push_back(0);
+        } else {
+            slot = window.oldestSlot;
+            window.oldestSlot = (window.oldestSlot + 1) % window.capacity;
+            isOverwritten[slot] = 1;
+        }
+        slots.push_back(slot);
+        store.labels[slot] = source.labels[row];
+        store.numClasses = max(store.numClasses, source.labels[row] + 1);
+        for (int j = 0; j < numFeatures && !store.isBinned(); ++j) store.ownedColumns[j][slot] = value(row, j);
+    }
+
+    if (store.isBinned()) {
+        // The first rows ever added set the boundaries; later rows are only binned
+        if (store.binMapper.boundaries.empty()) {
+            store.binMapper.boundaries.resize(numFeatures);
+            vector<double> values(end - begin);
+            for (int j = 0; j < numFeatures; ++j) {
+                for (long row = begin; row < end; ++row) values[row - begin] = value(row, j);
+                store.binMapper.boundaries[j] = computeBinBoundaries(sortIntoRuns(values.data(), values.size()), values.size(), store.binMapper.maxBins);
+            }
+        }
+        for (int j = 0; j < numFeatures; ++j) {
+            for (size_t i = 0; i < slots.size(); ++i) {
+                store.binnedColumns[j][slots[i]] = findBin(store.binMapper.boundaries[j], value(begin + i, j));
+            }
+        }
+        return;
+    }
+
+    // Drop the overwritten slots from every feature's order, then merge in the new ones, sorted
+    vector<int> added(slots.size());
+    for (int j = 0; j < numFeatures; ++j) {
+        const double* values = store.columns[j];
+        vector<int>& sorted = window.sortedSlots[j];
+        sorted.erase(remove_if(sorted.begin(), sorted.end(), [&isOverwritten](int slot) { return isOverwritten[slot]; }), sorted.end());
+        copy(slots.begin(), slots.end(), added.begin());
+        sort(added.begin(), added.end(), [values](int a, int b) { return values[a] < values[b]; });
+        size_t middle = sorted.size();
+        sorted.insert(sorted.end(), added.begin(), added.end());
+        inplace_merge(sorted.begin(), sorted.begin() + middle, sorted.end(), [values](int a, int b) { return values[a] < values[b]; });
+    }
+}
+
+// Function to train a tree on the rows of a window, with the engine the window was created for. If leafCounts is
+// given, it receives the number of training rows of every leaf in preorder.
+Node* trainWindow(const SlidingWindow& window, const vector<int>& features, TrainingOptions options, vector<uint64_t>* leafCounts = nullptr) {
+    if (window.store.isBinned()) return buildTreeHistogram(window.store, features, options, leafCounts);
+    options.maxBins = 0;
+    return buildTreePresorted(window.store, features, options, &window.sortedSlots, leafCounts);
+}
+
+// Function to time batch classification of a column store on 1, 2, 4, ... threads up to the number of cores, and
+// print the throughput, the speedup over one thread and the parallel efficiency (speedup per thread)
+void reportInferenceScaling(const Node* root, const ColumnStore& store, ostream& out) {
+    typedef chrono::steady_clock Clock;
+    int maxThreads = max(1u, thread::hardware_concurrency());
+    double oneThreadSeconds = 0;
+    out << "Threads  Rows/s  Speedup  Efficiency" << endl;
+    for (int numThreads = 1; ; numThreads = min(2 * numThreads, maxThreads)) {
+        ThreadPool pool(numThreads);
+        double seconds = numeric_limits<double>::max();
+        for (int run = 0; run < 3; ++run) { // Best of three
+            Clock::time_point start = Clock::now();
+            classifyBatch(root, store, pool);
+            seconds = min(seconds, chrono::duration<double>(Clock::now() - start).count());
+        }
+        if (numThreads == 1) oneThreadSeconds = seconds;
+        double speedup = oneThreadSeconds / seconds;
+        out << numThreads << "  " << store.numRows / seconds << "  " << speedup << "  " << speedup / numThreads << endl;
+        if (numThreads == maxThreads) break;
+    }
+}
+
+// Function to time histogram training and batch classification with prefetching on and off, and print both times
+// and the speedup from prefetching. Training uses the histogram engine (256 bins unless options say otherwise).
+void reportPrefetchEffect(const Node* root, const ColumnStore& store, const vector<int>& features, TrainingOptions options, ostream& out) {
+    typedef chrono::steady_clock Clock;
+    options.maxBins = options.maxBins > 0 ? options.maxBins : 256;
+    ThreadPool pool(options.numThreads);
+    double seconds[2][2]; // [training, classification][prefetch off, on]
+    for (int prefetch = 0; prefetch < 2; ++prefetch) {
+        options.prefetch = prefetch;
+        seconds[0][prefetch] = seconds[1][prefetch] = numeric_limits<double>::max();
+        for (int run = 0; run < 3; ++run) { // Best of three
+            Clock::time_point start = Clock::now();
+            deleteTree(buildTreeHistogram(store, features, options));
+            Clock::time_point trained = Clock::now();
+            classifyBatch(root, store, pool, prefetch);
+            Clock::time_point classified = Clock::now();
+            seconds[0][prefetch] = min(seconds[0][prefetch], chrono::duration<double>(trained - start).count());
+            seconds[1][prefetch] = min(seconds[1][prefetch], chrono::duration<double>(classified - trained).count());
+        }
+    }
+    const char* names[2] = {"Histogram training", "Batch classification"};
+    for (int task = 0; task < 2; ++task) {
+        out << names[task] << ": " << seconds[task][0] << " s without prefetch, " << seconds[task][1] << " s with, speedup "
+            << seconds[task][0] / seconds[task][1] << endl;
+    }
+}
+
+// Function to compute the depth of a tree (0 for a single leaf)
+int treeDepth(const Node* node) {
+    if (node->featureIndex == -1) return 0;
+    return 1 + max(treeDepth(node->left), treeDepth(node->right));
+}
+
+// Function to mark the features a tree tests
+void markTestedFeatures(const Node* node, vector<bool>& tested) {
+    if (node->featureIndex == -1) return;
+    tested[node->featureIndex] = true;
+    markTestedFeatures(node->left, tested);
+    markTestedFeatures(node->right, tested);
+}
+
+// Function to generate a column store of uniform features whose labels follow x0 + x1 > 1 with 10% of them flipped,
+// so that trees grow deep on large stores
+ColumnStore generateBenchmarkStore(long numRows, int numFeatures, uint64_t seed) {
+    mt19937_64 random(seed);
+    uniform_real_distribution<double> uniform(0, 1);
+    ColumnStore store;
+    for (int j = 0; j < numFeatures; ++j) store.ownedColumns.emplace_back(numRows);
+    for (int j = 0; j < numFeatures; ++j) store.columns.push_back(store.ownedColumns[j].data());
+    store.labels.resize(numRows);
+    store.numRows = numRows;
+    for (long i = 0; i < numRows; ++i) {
+        for (int j = 0; j < numFeatures; ++j) store.ownedColumns[j][i] = uniform(random);
+        bool label = store.columns[0][i] + store.columns[min(1, numFeatures - 1)][i] > 1;
+        store.labels[i] = label != (random() % 10 == 0);
+    }
+    return store;
+}
+
+// Function to time training with both engines and batch classification on generated stores of maxRows / 100,
+// maxRows / 10 and maxRows rows by 4, 16 and 64 features, on 1, 2, 4, ... threads up to maxThreads. Prints the
+// best-of-three time, the speedup over one thread, the parallel efficiency (speedup per thread) and the memory
+// bandwidth, estimated as the bytes each pass streams divided by the time: training makes a pass per tree level over
+// the working set trainTree plans its memory with (sorted row indices, value runs and class counts per feature and row
+// for the presorted engine; bins and row indices for the histogram engine), and classification makes one pass over
+// the feature columns the tree tests and the predictions.
+void reportScalingSweep(long maxRows, int maxThreads, ostream& out) {
+    typedef chrono::steady_clock Clock;
+    const char* taskNames[3] = {"presorted", "histogram", "classify"};
+    out << "Task  Rows  Features  Threads  Seconds  Speedup  Efficiency  GB/s" << endl;
+    for (long numRows : {max(maxRows / 100, 1000L), max(maxRows / 10, 1000L), max(maxRows, 1000L)}) {
+        for (int numFeatures : {4, 16, 64}) {
+            ColumnStore store = generateBenchmarkStore(numRows, numFeatures, numRows + numFeatures);
+            vector<int> features(numFeatures);
+            for (int j = 0; j < numFeatures; ++j) features[j] = j;
+            TrainingOptions options;
+            Node* root = trainTree(store, features, options);
+            vector<bool> tested(numFeatures, false);
+            markTestedFeatures(root, tested);
+            double classifyBytes = numRows * (count(tested.begin(), tested.end(), true) + 1.0) * sizeof(double);
+
+            for (int task = 0; task < 3; ++task) {
+                double oneThreadSeconds = 0;
+                for (int numThreads = 1; ; numThreads = min(2 * numThreads, maxThreads)) {
+                    ThreadPool pool(numThreads);
+                    options.numThreads = numThreads;
+                    options.maxBins = task == 1 ? 256 : 0;
+                    double seconds = numeric_limits<double>::max();
+                    int depth = 0;
+                    for (int run = 0; run < 3; ++run) { // Best of three
+                        Clock::time_point start = Clock::now();
+                        if (task < 2) {
+                            Node* tree = trainTree(store, features, options);
+                            seconds = min(seconds, chrono::duration<double>(Clock::now() - start).count());
+                            depth = treeDepth(tree);
+                            deleteTree(tree);
+                        } else {
+                            classifyBatch(root, store, pool);
+                            seconds = min(seconds, chrono::duration<double>(Clock::now() - start).count());
+                        }
+                    }
+                    double bytes = task == 0 ? (depth + 1.0) * numRows * numFeatures * (sizeof(int) + sizeof(double) + store.numClasses * sizeof(int))
+                                 : task == 1 ? (depth + 1.0) * numRows * (numFeatures * sizeof(uint8_t) + sizeof(uint32_t))
+                                 : classifyBytes;
+                    if (numThreads == 1) oneThreadSeconds = seconds;
+                    double speedup = oneThreadSeconds / seconds;
+                    out << taskNames[task] << "  " << numRows << "  " << numFeatures << "  " << numThreads << "  " << seconds
+                        << "  " << speedup << "  " << speedup / numThreads << "  " << bytes / seconds / 1e9 << endl;
+                    if (numThreads == maxThreads) break;
+                }
+            }
+            deleteTree(root);
+        }
+    }
+}
+
+// Structure to count the outcomes of comparing engines against the reference implementation
+struct DifferentialResult {
+    long ties = 0;       // Different splits with equal scores, after which the subtrees are not compared
+    long mismatches = 0; // Different splits with different scores, different leaves, or different predictions
+};
+
+// Function to compute the exact score sum(left counts^2) / nLeft + sum(right counts^2) / nRight of a partition of
+// rows, as the numerator and denominator compared by isBetterScore
+SplitScore partitionScore(const vector<vector<double>>& dataset, const vector<long>& left, const vector<long>& right, int numClasses) {
+    vector<uint64_t> leftCounts(numClasses, 0), rightCounts(numClasses, 0);
+    for (long row : left) leftCounts[static_cast<int>(dataset[row].back())]++;
+    for (long row : right) rightCounts[static_cast<int>(dataset[row].back())]++;
+    unsigned __int128 leftSquares = 0, rightSquares = 0;
+    for (int c = 0; c < numClasses; ++c) {
+        leftSquares += static_cast<unsigned __int128>(leftCounts[c]) * leftCounts[c];
+        rightSquares += static_cast<unsigned __int128>(rightCounts[c]) * rightCounts[c];
+    }
+    return {leftSquares * right.size() + rightSquares * left.size(), static_cast<unsigned __int128>(left.size()) * right.size()};
+}
+
+// Function to compare two trees on the rows of a dataset that reach a node. Splits are compared by the partition
+// of the rows they make, so that thresholds anywhere between the same two values agree.
+void compareTrees(const Node* a, const Node* b, const vector<vector<double>>& dataset, const vector<long>& rows, int numClasses, DifferentialResult& result) {
+    if (a->featureIndex == -1 || b->featureIndex == -1) {
+        if (a->featureIndex != b->featureIndex || a->classLabel != b->classLabel) result.mismatches++;
+        return;
+    }
+    vector<long> leftA, rightA, leftB, rightB;
+    for (long row : rows) {
+        (dataset[row][a->featureIndex] < a->splitValue ? leftA : rightA).push_back(row);
+        (dataset[row][b->featureIndex] < b->splitValue ? leftB : rightB).push_back(row);
+    }
+    if (leftA != leftB) {
+        bool proper = !leftA.empty() && !rightA.empty() && !leftB.empty() && !rightB.empty();
+        SplitScore scoreA = proper ? partitionScore(dataset, leftA, rightA, numClasses) : SplitScore();
+        SplitScore scoreB = proper ? partitionScore(dataset, leftB, rightB, numClasses) : SplitScore();
+        if (proper && !isBetterScore(scoreA, scoreB) && !isBetterScore(scoreB, scoreA)) {
+            result.ties++;
+        } else {
+            result.mismatches++;
+        }
+        return;
+    }
+    compareTrees(a->left, b->left, dataset, leftA, numClasses, result);
+    compareTrees(a->right, b->right, dataset, rightA, numClasses, result);
+}
+
+// Function to check a tree grown with TrainingOptions::dropZeroGainFeatures on the rows that reach a node, given the
+// features still active there. Every split must score as well as the best split on the active features, and only
+// the features whose best split beats the unsplit node stay active below it; a node without any split on its active
+// features must be a leaf of a majority class. Where dropping stops the tree early, these leaves are the fewest
+// training errors the option allows.
+void compareDroppingTree(const Node* tree, const vector<vector<double>>& dataset, const vector<long>& rows, const vector<int>& features,
+                         int numClasses, DifferentialResult& result) {
+    vector<uint64_t> classCounts(numClasses, 0);
+    for (long row : rows) classCounts[static_cast<int>(dataset[row].back())]++;
+    uint64_t majority = *max_element(classCounts.begin(), classCounts.end());
+    unsigned __int128 squares = 0;
+    for (uint64_t count : classCounts) squares += static_cast<unsigned __int128>(count) * count;
+    SplitScore parentScore = {squares, static_cast<unsigned __int128>(rows.size())};
+
+    SplitScore bestScore;
+    bool hasSplit = false;
+    vector<int> gainFeatures;
+    if (majority < rows.size()) {
+        for (int feature : features) {
+            vector<double> values;
+            for (long row : rows) values.push_back(dataset[row][feature]);
+            sort(values.begin(), values.end());
+            values.erase(unique(values.begin(), values.end()), values.end());
+            bool hasGain = false;
+            for (size_t i = 1; i < values.size(); ++i) {
+                double threshold = (values[i - 1] + values[i]) / 2.0;
+                vector<long> left, right;
+                for (long row : rows) (dataset[row][feature] < threshold ? left : right).push_back(row);
+                SplitScore score = partitionScore(dataset, left, right, numClasses);
+                hasGain = hasGain || isBetterScore(score, parentScore);
+                if (!hasSplit || isBetterScore(score, bestScore)) bestScore = score;
+                hasSplit = true;
+            }
+            if (hasGain) gainFeatures.push_back(feature);
+        }
+    }
+    if (!hasSplit || tree->featureIndex == -1) {
+        if (hasSplit || tree->featureIndex != -1 || classCounts[static_cast<int>(tree->classLabel)] != majority) result.mismatches++;
+        return;
+    }
+
+    vector<long> left, right;
+    for (long row : rows) (dataset[row][tree->featureIndex] < tree->splitValue ? left : right).push_back(row);
+    if (find(features.begin(), features.end(), tree->featureIndex) == features.end() || left.empty() || right.empty() ||
+        isBetterScore(bestScore, partitionScore(dataset, left, right, numClasses))) {
+        result.mismatches++;
+        return;
+    }
+    compareDroppingTree(tree->left, dataset, left, gainFeatures, numClasses, result);
+    compareDroppingTree(tree->right, dataset, right, gainFeatures, numClasses, result);
+}
+
+// Function to count the training rows a tree misclassifies, and the fewest any tree on the mapper's bins can:
+// the rows outside the majority class of their bin vector
+pair<long, long> binnedErrors(const Node* root, const vector<vector<double>>& dataset, const vector<int>& features, const BinMapper& mapper, int numClasses) {
+    map<vector<int>, vector<long>> groups; // Class counts per bin vector
+    long errors = 0;
+    for (const vector<double>& row : dataset) {
+        vector<int> bins;
+        for (int featureIndex : features) bins.push_back(findBin(mapper.boundaries[featureIndex], row[featureIndex]));
+        vector<long>& counts = groups[bins];
+        counts.resize(numClasses, 0);
+        counts[static_cast<int>(row.back())]++;
+        if (classify(const_cast<Node*>(root), row) != row.back()) errors++;
+    }
+    long fewestErrors = 0;
+    for (const pair<const vector<int>, vector<long>>& group : groups) {
+        long size = 0;
+        for (long count : group.second) size += count;
+        fewestErrors += size - *max_element(group.second.begin(), group.second.end());
+    }
+    return make_pair(errors, fewestErrors);
+}
+
+// Function to generate a random dataset for differential testing: up to 250 rows (so that 256 bins lose nothing),
+// 1 to 5 features of continuous, small integer, mostly zero or negative values, and classes 0 and 1, the only ones
+// the reference Gini counts. Sets features to a random subset of the features to train on. Labels follow a rule of
+// those features with some hashed noise, so that rows equal on them always have equal labels, which the reference
+// implementation requires.
+vector<vector<double>> generateDifferentialDataset(uint64_t seed, vector<int>& features) {
+    mt19937_64 random(seed);
+    long numRows = 2 + random() % 249;
+    int numFeatures = 1 + random() % 5;
+    int kind = random() % 4;
+    features.clear();
+    for (int j = 0; j < numFeatures; ++j) {
+        if (random() % 4 != 0 || (features.empty() && j == numFeatures - 1)) features.push_back(j);
+    }
+    vector<vector<double>> dataset(numRows, vector<double>(numFeatures + 1));
+    for (vector<double>& row : dataset) {
+        for (int j = 0; j < numFeatures; ++j) {
+            switch (kind) {
+                case 0: row[j] = uniform_real_distribution<double>(0, 1)(random); break;
+                case 1: row[j] = random() % 5; break;
+                case 2: row[j] = random() % 3 == 0 ? uniform_real_distribution<double>(-1, 1)(random) : 0.0; break;
+                default: row[j] = static_cast<double>(random() % 41) - 20.0; break;
+            }
+        }
+        uint64_t hash = seed;
+        for (int featureIndex : features) {
+            uint64_t bits;
+            memcpy(&bits, &row[featureIndex], sizeof(bits));
+            hash = (hash ^ bits) * 0x9E3779B97F4A7C15ull;
+            hash ^= hash >> 29;
+        }
+        int rule = row[features[0]] > (kind == 1 ? 2.0 : kind == 3 ? 0.0 : 0.3) ? 1 : 0;
+        row[numFeatures] = hash % 4 == 0 ? 1 - rule : rule;
+    }
+    return dataset;
+}
+
+// Structure to hold an Arrow record batch exported from a dataset through the C data interface: the features as
+// float64 columns, which the import borrows, and the labels as an int32 column, which it converts. Every child holds
+// a leading padding row, and the struct array skips it with offset 1, as a sliced batch would.
+struct DatasetArrowBatch {
+    vector<vector<double>> featureValues;
+    vector<int32_t> labelValues;
+    vector<array<const void*, 2>> childBuffers;
+    vector<ArrowSchema> childSchemas;
+    vector<ArrowArray> childArrays;
+    vector<ArrowSchema*> childSchemaPointers;
+    vector<ArrowArray*> childArrayPointers;
+    const void* structBuffers[1] = {nullptr};
+    ArrowSchema schema;
+    ArrowArray batch;
+};
+
+// Function to export a dataset (class label last) as an Arrow batch, whose label column has index numFeatures
+void exportArrowBatch(const vector<vector<double>>& dataset, int numFeatures, DatasetArrowBatch& arrow) {
+    long numRows = dataset.size();
+    arrow.featureValues.assign(numFeatures, vector<double>(numRows + 1, -1.0));
+    arrow.labelValues.assign(numRows + 1, -1);
+    for (long i = 0; i < numRows; ++i) {
+        for (int j = 0; j < numFeatures; ++j) arrow.featureValues[j][i + 1] = dataset[i][j];
+        arrow.labelValues[i + 1] = static_cast<int32_t>(dataset[i].back());
+    }
+    arrow.childBuffers.resize(numFeatures + 1);
+    arrow.childSchemas.resize(numFeatures + 1);
+    arrow.childArrays.resize(numFeatures + 1);
+    for (int j = 0; j <= numFeatures; ++j) {
+        arrow.childBuffers[j] = {nullptr, j < numFeatures ? static_cast<const void*>(arrow.featureValues[j].data()) : arrow.labelValues.data()};
+        arrow.childSchemas[j] = {j < numFeatures ? "g" : "i", "", nullptr, 0, 0, nullptr, nullptr, nullptr, nullptr};
+        arrow.childArrays[j] = {numRows + 1, 0, 0, 2, 0, arrow.childBuffers[j].data(), nullptr, nullptr, nullptr, nullptr};
+        arrow.childSchemaPointers.push_back(&arrow.childSchemas[j]);
+        arrow.childArrayPointers.push_back(&arrow.childArrays[j]);
+    }
+    arrow.schema = {"+s", "", nullptr, 0, numFeatures + 1, arrow.childSchemaPointers.data(), nullptr, nullptr, nullptr};
+    arrow.batch = {numRows, 0, 1, 1, numFeatures + 1, arrow.structBuffers, arrow.childArrayPointers.data(), nullptr, nullptr, nullptr};
+}
+
+// Function to build a compressed sparse column or row matrix of the features of a dataset
+SparseMatrix buildSparseMatrix(const vector<vector<double>>& dataset, int numFeatures, bool columnMajor) {
+    SparseMatrix matrix;
+    matrix.numRows = dataset.size();
+    matrix.numColumns = numFeatures;
+    matrix.columnMajor = columnMajor;
+    long numLines = columnMajor ? numFeatures : matrix.numRows;
+    long lineLength = columnMajor ? matrix.numRows : numFeatures;
+    for (long line = 0; line < numLines; ++line) {
+        matrix.offsets.push_back(matrix.indices.size());
+        for (long i = 0; i < lineLength; ++i) {
+            double value = columnMajor ? dataset[i][line] : dataset[line][i];
+            if (value == 0.0) continue;
+            matrix.indices.push_back(i);
+            matrix.values.push_back(value);
+        }
+    }
+    matrix.offsets.push_back(matrix.indices.size());
+    return matrix;
+}
+
+// Whether the reference buildTree can grow a tree on the dataset. Its best split starts from an infinite Gini, so
+// where no split improves on another it may take a midpoint between equal values and recurse into an empty side.
+bool referenceCanBuild(const vector<vector<double>>& dataset, const vector<int>& features) {
+    double firstLabel = dataset[0].back();
+    if (all_of(dataset.begin(), dataset.end(), [firstLabel](const vector<double>& dataPoint) {
+        return dataPoint.back() == firstLabel;
+    })) {
+        return true;
+    }
+    pair<int, double> bestSplit = findBestSplit(dataset, features);
+    auto subsets = splitDataset(dataset, bestSplit.first, bestSplit.second);
+    if (subsets.first.empty() || subsets.second.empty()) return false;
+    return referenceCanBuild(subsets.first, features) && referenceCanBuild(subsets.second, features);
+}
+
+// Function to train every engine on random datasets and compare it with the reference buildTree, and the inference
+// paths with the reference classify. Exact engines, and the histogram engine on 256 bins (which lose nothing on these
+// datasets), must build the same tree up to splits of equal score, and count the training rows of its leaves as
+// classifying them does. Binned engines on fewer bins are compared with the fewest training errors their bins allow,
+// and dropping zero-gain features with compareDroppingTree. The trees must also survive a saveModel/loadModel and a
+// compact file round-trip, and quantized inference must agree wherever it applies.
+// Prints every mismatching seed and engine; returns their number.
+int runDifferentialCheck(int numSeeds, ostream& out) {
+    long numRuns = 0, numTies = 0;
+    int numMismatches = 0, numSkipped = 0;
+    for (int seed = 0; seed < numSeeds; ++seed) {
+        const int numClasses = 2;
+        vector<int> features, testFeatures;
+        vector<vector<double>> dataset = generateDifferentialDataset(seed, features);
+        if (!referenceCanBuild(dataset, features)) {
+            numSkipped++;
+            continue;
+        }
+        int numFeatures = dataset[0].size() - 1;
+        mt19937_64 random(seed + 0x5bd1e995);
+        vector<long> rows(dataset.size());
+        for (size_t i = 0; i < rows.size(); ++i) rows[i] = i;
+        Node* reference = buildTree(dataset, features);
+        auto report = [&](const string& engine, long mismatches) {
+            numRuns++;
+            if (mismatches == 0) return;
+            numMismatches++;
+            out << "Mismatch: seed " << seed << ", " << engine << ": " << mismatches << endl;
+        };
+
+        // Engines that must match the reference exactly
+        enum Input { Rows, SparseColumns, ArrowBatch };
+        struct Engine { const char* name; int maxBins; int numThreads; bool exactScoring; Input input; TrainingOptions::NumaPolicy numa; };
+        const Engine engines[] = {
+            {"presorted", 0, 1, true, Rows, TrainingOptions::NumaDefault},
+            {"presorted, 3 threads", 0, 3, true, Rows, TrainingOptions::NumaDefault},
+            {"presorted, float scoring", 0, 1, false, Rows, TrainingOptions::NumaDefault},
+            {"histogram, 256 bins", 256, 1, true, Rows, TrainingOptions::NumaDefault},
+            {"histogram, 256 bins, 3 threads", 256, 3, true, Rows, TrainingOptions::NumaDefault},
+            {"histogram, NUMA partition", 0, 2, true, Rows, TrainingOptions::NumaPartition},
+            {"histogram, sparse columns", 256, 2, true, SparseColumns, TrainingOptions::NumaDefault},
+            {"presorted, Arrow batch", 0, 1, true, ArrowBatch, TrainingOptions::NumaDefault},
+        };
+        DatasetArrowBatch arrow;
+        exportArrowBatch(dataset, numFeatures, arrow);
+        ColumnStore trainingStore = buildColumnStore(dataset);
+        Node* exactTree = nullptr;
+        Node* binnedTree = nullptr;
+        BinMapper binnedMapper;
+        for (const Engine& engine : engines) {
+            TrainingOptions options;
+            options.maxBins = engine.maxBins;
+            options.numThreads = engine.numThreads;
+            options.exactScoring = engine.exactScoring;
+            options.numaPolicy = engine.numa;
+            BinMapper mapper;
+            vector<uint64_t> leafCounts;
+            Node* tree;
+            if (engine.input == SparseColumns) {
+                ColumnStore store;
+                store.sparseColumns = buildSparseMatrix(dataset, numFeatures, true);
+                store.numRows = dataset.size();
+                vector<double> labels;
+                for (const vector<double>& row : dataset) labels.push_back(row.back());
+                importLabels(labels.data(), store);
+                tree = trainTree(store, features, options, &mapper, &leafCounts);
+            } else if (engine.input == ArrowBatch) {
+                ColumnStore store;
+                if (!importArrowBatch(&arrow.schema, &arrow.batch, numFeatures, store)) {
+                    report(engine.name, 1);
+                    continue;
+                }
+                tree = trainTree(store, features, options, &mapper, &leafCounts);
+            } else {
+                tree = trainTree(dataset, features, options, &mapper, &leafCounts);
+            }
+            DifferentialResult result;
+            compareTrees(reference, tree, dataset, rows, numClasses, result);
+            numTies += result.ties;
+            report(engine.name, result.mismatches + (leafCounts != countLeafVisits(tree, trainingStore, 1)));
+            if (exactTree == nullptr) {
+                exactTree = tree;
+            } else if (binnedTree == nullptr && engine.maxBins > 0) {
+                binnedTree = tree;
+                binnedMapper = mapper;
+            } else {
+                deleteTree(tree);
+            }
+        }
+
+        // Binned engines that lose information: as few training errors as their bins allow
+        for (int maxBins : {2, 4, 16}) {
+            for (int sketchSize : {0, 8}) {
+                TrainingOptions options;
+                options.maxBins = maxBins;
+                options.sketchSize = sketchSize;
+                BinMapper mapper;
+                Node* tree = trainTree(dataset, features, options, &mapper);
+                pair<long, long> errors = binnedErrors(tree, dataset, features, mapper, numClasses);
+                report("histogram, " + to_string(maxBins) + " bins" + (sketchSize > 0 ? ", sketched" : ""), errors.first - errors.second);
+                deleteTree(tree);
+            }
+        }
+        TrainingOptions droppingOptions;
+        droppingOptions.dropZeroGainFeatures = true;
+        Node* droppingTree = trainTree(dataset, features, droppingOptions);
+        DifferentialResult dropping;
+        compareDroppingTree(droppingTree, dataset, rows, features, numClasses, dropping);
+        report("presorted, dropping zero-gain features", dropping.mismatches);
+        deleteTree(droppingTree);
+
+        // Model files: the trees, bins and leaf counts read back as they were written
+        const char* directory = getenv("TMPDIR");
+        string modelPath = string(directory ? directory : "/tmp") + "/cart-model-XXXXXX";
+        int fd = mkstemp(&modelPath[0]);
+        if (fd != -1) close(fd);
+        vector<uint64_t> leafCounts = countLeafVisits(binnedTree, trainingStore, 1);
+        for (const Node* tree : {exactTree, binnedTree}) {
+            const BinMapper& savedMapper = tree == binnedTree ? binnedMapper : BinMapper();
+            Node* loaded = nullptr;
+            BinMapper loadedMapper;
+            vector<uint64_t> loadedCounts;
+            if (fd == -1 || !saveModel(modelPath, tree, savedMapper, leafCounts) || !loadModel(modelPath, loaded, loadedMapper, &loadedCounts)) {
+                report("saveModel/loadModel", 1);
+                continue;
+            }
+            DifferentialResult result;
+            compareTrees(tree, loaded, dataset, rows, numClasses, result);
+            bool sameFile = loadedMapper.boundaries == savedMapper.boundaries && loadedMapper.maxBins == savedMapper.maxBins &&
+                            loadedCounts == leafCounts;
+            report("saveModel/loadModel", result.mismatches + result.ties + !sameFile);
+            deleteTree(loaded);
+        }
+
+        // Inference paths, on rows drawn like the training rows and from outside their range
+        vector<vector<double>> testRows = generateDifferentialDataset(seed + numSeeds, testFeatures);
+        for (vector<double>& row : testRows) {
+            row.resize(numFeatures + 1);
+            if (random() % 8 == 0) row[random() % numFeatures] *= 100;
+        }
+        ColumnStore testStore = buildColumnStore(testRows);
+        SparseMatrix testMatrix = buildSparseMatrix(testRows, numFeatures, false);
+        vector<double> expected, expectedBinned;
+        for (const vector<double>& row : testRows) {
+            expected.push_back(classify(exactTree, row));
+            expectedBinned.push_back(classify(binnedTree, row));
+        }
+        auto countDifferences = [](const vector<double>& a, const vector<double>& b) {
+            long differences = 0;
+            for (size_t i = 0; i < a.size(); ++i) differences += a[i] != b[i];
+            return differences;
+        };
+        ThreadPool pool(3);
+        vector<double> byRow;
+        for (long row = 0; row < testStore.numRows; ++row) byRow.push_back(classify(exactTree, testStore, row));
+        report("classify by row", countDifferences(expected, byRow));
+        report("classifyBatch", countDifferences(expected, classifyBatch(exactTree, testStore)));
+        report("classifyBatch, 3 threads", countDifferences(expected, classifyBatch(exactTree, testStore, pool)));
+        report("classifyBatch, no prefetch", countDifferences(expected, classifyBatch(exactTree, testStore, pool, false)));
+        report("classifyBatch, sparse rows", countDifferences(expected, classifyBatch(exactTree, testMatrix)));
+        DatasetArrowBatch testArrow;
+        exportArrowBatch(testRows, numFeatures, testArrow);
+        ColumnStore testArrowStore;
+        if (!importArrowBatch(&testArrow.schema, &testArrow.batch, -1, testArrowStore)) {
+            report("classifyBatch, Arrow batch", 1);
+        } else {
+            report("classifyBatch, Arrow batch", countDifferences(expected, classifyBatch(exactTree, testArrowStore, pool)));
+        }
+        VisitCounters counters(exactTree, pool.size());
+        report("classifyBatchCounted", countDifferences(expected, classifyBatchCounted(counters, testStore, pool)));
+
+        // Quantized thresholds: whenever the conversion accepts a tree, it classifies the training rows as the tree
+        // does; stores without dense columns are refused
+        vector<double> trainingExpected;
+        for (const vector<double>& row : dataset) trainingExpected.push_back(classify(exactTree, row));
+        QuantizedTree<uint8_t> narrowTree;
+        QuantizedTree<uint16_t> wideTree;
+        if (quantizeTree(exactTree, trainingStore, narrowTree)) {
+            report("quantized, 8-bit", countDifferences(trainingExpected, classifyQuantizedBatch(narrowTree, trainingStore)));
+        }
+        if (quantizeTree(exactTree, trainingStore, wideTree)) {
+            report("quantized, 16-bit", countDifferences(trainingExpected, classifyQuantizedBatch(wideTree, trainingStore)));
+        }
+        ColumnStore sparseStore;
+        sparseStore.sparseColumns = buildSparseMatrix(dataset, numFeatures, true);
+        sparseStore.numRows = dataset.size();
+        report("quantized, sparse store refused", quantizeTree(exactTree, sparseStore, wideTree) ? 1 : 0);
+
+        vector<BinnedNode> compiled, decoded;
+        if (!compileBinnedTree(binnedTree, binnedMapper, compiled) || !decodeBinnedTree(encodeBinnedTree(compiled), binnedMapper, decoded)) {
+            report("compiled binned tree", 1);
+        } else {
+            vector<vector<double>> binned = classifyBinnedBatch({compiled, decoded}, binnedMapper, testStore, pool);
+            report("classifyBinnedBatch", countDifferences(expectedBinned, binned[0]));
+            report("classifyBinnedBatch, decoded", countDifferences(expectedBinned, binned[1]));
+            BinMapper loadedMapper;
+            vector<vector<BinnedNode>> loaded;
+            if (fd == -1 || !saveCompactTrees(modelPath, binnedMapper, {compiled, compiled}) || !loadCompactTrees(modelPath, loadedMapper, loaded)
+                || loaded.size() != 2 || loadedMapper.boundaries != binnedMapper.boundaries) {
+                report("classifyBinnedBatch, compact file", 1);
+            } else {
+                binned = classifyBinnedBatch(loaded, loadedMapper, testStore, pool);
+                report("classifyBinnedBatch, compact file", countDifferences(expectedBinned, binned[0]) + countDifferences(expectedBinned, binned[1]));
+            }
+        }
+        if (fd != -1) remove(modelPath.c_str());
+        deleteTree(reference);
+        deleteTree(exactTree);
+        deleteTree(binnedTree);
+    }
+    out << "Differential check: " << numSeeds << " seeds (" << numSkipped << " the reference cannot build), "
+        << numRuns << " comparisons, " << numTies << " ties between splits of equal score, " << numMismatches
+        << " mismatches" << endl;
+    return numMismatches;
+}
+
+// Function to parse a byte count with an optional K, M or G suffix (powers of 1024)
+long parseByteSize(const string& text) {
+    char* suffix = nullptr;
+    double value = strtod(text.c_str(), &suffix);
+    switch (*suffix) {
+        case 'G': case 'g': value *= 1024;  // Fall through
+        case 'M': case 'm': value *= 1024;  // Fall through
+        case 'K': case 'k': value *= 1024;
+    }
+    return static_cast<long>(value);
+}
+
+// Function to print the memory held by the training data structures and the peak resident set size
+void printMemoryReport(ostream& out) {
+    static const char* categoryNames[NumMemoryCategories] = {"dataset", "indices", "histograms", "nodes"};
+    out << "Memory held:";
+    for (int category = 0; category < NumMemoryCategories; ++category) {
+        out << " " << categoryNames[category] << " " << memoryAccount.current[category] << " B";
+    }
+    out << endl << "Peak tracked memory: " << memoryAccount.peak << " B (limit " << memoryAccount.limit << " B)"
+        << ", peak spilled to disk: " << memoryAccount.peakSpilled << " B, peak RSS: " << peakResidentBytes() << " B" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    // Parse the command line options
+    TrainingOptions options;
+    string dataPath;
+    bool pipeline = false;
+    bool scoreScaling = false;
+    bool prefetchBench = false;
+    long scalingRows = 0;
+    bool visitStats = false;
+    bool quantize = false;
+    string driftModelPath;
+    double driftThreshold = 0.2;
+    long windowRows = 0, windowStep = 0;
+    string modelPath;
+    string compactPath;
+    vector<string> scorePaths;
+    for (int i = 1; i < argc; ++i) {
+        string argument = argv[i];
+        if (argument == "--data" && i + 1 < argc) {
+            dataPath = argv[++i];
+        } else if (argument == "--memory-limit" && i + 1 < argc) {
+            options.memoryLimit = parseByteSize(argv[++i]);
+        } else if (argument == "--threads" && i + 1 < argc) {
+            options.numThreads = atoi(argv[++i]);
+        } else if (argument == "--bins" && i + 1 < argc) {
+            options.maxBins = atoi(argv[++i]);
+        } else if (argument == "--save-model" && i + 1 < argc) {
+            modelPath = argv[++i];
+        } else if (argument == "--save-compact" && i + 1 < argc) {
+            compactPath = argv[++i];
+        } else if (argument == "--score" && i + 1 < argc) {
+            scorePaths.push_back(argv[++i]);
+        } else if (argument == "--sketch" && i + 1 < argc) {
+            options.sketchSize = atoi(argv[++i]);
+        } else if (argument == "--self-check" && i + 1 < argc) {
+            return runDifferentialCheck(atoi(argv[++i]), cout) == 0 ? 0 : 1;
+        } else if (argument == "--scaling-bench" && i + 1 < argc) {
+            scalingRows = atol(argv[++i]);
+        } else if (argument == "--drift" && i + 1 < argc) {
+            driftModelPath = argv[++i];
+        } else if (argument == "--drift-threshold" && i + 1 < argc) {
+            driftThreshold = atof(argv[++i]);
+        } else if (argument == "--window" && i + 1 < argc) {
+            windowRows = atol(argv[++i]);
+        } else if (argument == "--window-step" && i + 1 < argc) {
+            windowStep = atol(argv[++i]);
+        } else if (argument == "--quantize") {
+            quantize = true;
+        } else if (argument == "--visit-stats") {
+            visitStats = true;
+        } else if (argument == "--prefetch-bench") {
+            prefetchBench = true;
+        } else if (argument == "--score-scaling") {
+            scoreScaling = true;
+        } else if (argument == "--pipeline") {
+            pipeline = true;
+        } else if (argument == "--huge-pages") {
+            options.hugePages = true;
+        } else if (argument == "--numa" && i + 1 < argc && string(argv[i + 1]) == "interleave") {
+            options.numaPolicy = TrainingOptions::NumaInterleave;
+            ++i;
+        } else if (argument == "--numa" && i + 1 < argc && string(argv[i + 1]) == "partition") {
+            options.numaPolicy = TrainingOptions::NumaPartition;
+            ++i;
+        } else {
+            cerr << "Usage: " << argv[0] << " [--data FILE.npy|FILE.npz|FILE.svm] [--memory-limit BYTES[K|M|G]] [--threads N] [--bins N]"
+                 << " [--sketch SIZE] [--save-model FILE] [--save-compact FILE] [--score FILE]... [--score-scaling] [--prefetch-bench] [--scaling-bench ROWS] [--visit-stats] [--quantize] [--drift MODEL] [--drift-threshold PSI]"
+                 << " [--window ROWS] [--window-step ROWS] [--pipeline]"
+                 << " [--self-check SEEDS] [--huge-pages] [--numa interleave|partition]" << endl;
+            return 1;
+        }
+    }
+
+    if (scalingRows > 0) {
+        // Sweep generated datasets up to the given number of rows, on up to --threads threads or all cores
+        int maxThreads = options.numThreads > 1 ? options.numThreads : max(1u, thread::hardware_concurrency());
+        reportScalingSweep(scalingRows, maxThreads, cout);
+        return 0;
+    }
+
+    configureMemory(options); // Before loading, so that the loaders keep within the memory limit too
+    Node* root;
+    int numFeatures;
+    BinMapper binMapper;
+    vector<uint64_t> leafCounts; // Training rows per leaf, saved with the model for drift detection
+    if (!dataPath.empty()) {
+        // Load the dataset from the file (NumPy with the class label in the last column, or LibSVM) and split on all of its features
+        ColumnStore store;
+        bool isNumpy = dataPath.size() > 4 && (dataPath.compare(dataPath.size() - 4, 4, ".npy") == 0 || dataPath.compare(dataPath.size() - 4, 4, ".npz") == 0);
+        bool loaded;
+        if (isNumpy) {
+            loaded = loadNumpy(dataPath, true, store);
+        } else if (pipeline) {
+            // Read, parse and quantize a LibSVM file in overlapping stages
+            IngestStats stats;
+            loaded = ingestLibSvm(dataPath, options.maxBins > 0 ? options.maxBins : 256, options.numThreads, store, stats);
+            clog << "Ingested " << store.numRows << " rows in " << stats.totalSeconds << " s (busy: read "
+                 << stats.readSeconds << " s, parse " << stats.parseSeconds << " s, bin " << stats.binSeconds << " s)" << endl;
+        } else {
+            loaded = loadLibSvm(dataPath, options.numThreads, store);
+        }
+        if (!loaded) {
+            cerr << "Cannot load " << dataPath << endl;
+            return 1;
+        }
+        numFeatures = store.numFeatures();
+        if (!scorePaths.empty()) {
+            // Score the dataset with saved models and compact trees instead of training
+            return scoreBinnedModels(scorePaths, store, options.numThreads, clog) ? 0 : 1;
+        }
+        if (!driftModelPath.empty()) {
+            // Score the dataset as live traffic of a saved model, and only retrain on it if its leaf occupancy drifted
+            Node* model;
+            BinMapper modelMapper;
+            vector<uint64_t> trainingCounts;
+            if (!loadModel(driftModelPath, model, modelMapper, &trainingCounts)) {
+                cerr << "Cannot load the model " << driftModelPath << endl;
+                return 1;
+            }
+            ThreadPool pool(options.numThreads);
+            VisitCounters counters(model, pool.size());
+            bool usable = (store.isSparse() || !store.columns.empty()) && trainingCounts.size() == leafVisits(counters).size();
+            for (const Node* node : counters.nodes) usable = usable && (store.isSparse() || node->featureIndex < static_cast<int>(store.columns.size()));
+            if (!usable) {
+                cerr << "Drift detection needs the raw values of every feature the model tests and a model saved with its leaf counts" << endl;
+                deleteTree(model);
+                return 1;
+            }
+            classifyBatchCounted(counters, store, pool);
+            bool drifted = false;
+            DriftScore score = monitorDrift(trainingCounts, counters, driftThreshold, [&](const DriftScore&) { drifted = true; });
+            deleteTree(model);
+            clog << "Leaf occupancy drift from " << driftModelPath << ": PSI " << score.psi << ", KL " << score.kl << endl;
+            if (!drifted) return 0;
+            clog << "PSI above " << driftThreshold << ", retraining" << endl;
+        }
+        vector<int> features(numFeatures);
+        for (int i = 0; i < numFeatures; ++i) features[i] = i;
+        if (windowRows > 0 && (store.isSparse() || !store.columns.empty())) {
+            // Train on a window of the latest rows of a time-ordered dataset, moving it to the end in steps and
+            // retraining after each of them
+            typedef chrono::steady_clock Clock;
+            SlidingWindow window(numFeatures, windowRows, options.maxBins);
+            long end = min(windowRows, store.numRows);
+            advanceWindow(window, store, 0, end);
+            root = trainWindow(window, features, options, &leafCounts);
+            while (end < store.numRows) {
+                long next = min(end + (windowStep > 0 ? windowStep : max(windowRows / 10, 1L)), store.numRows);
+                Clock::time_point start = Clock::now();
+                advanceWindow(window, store, end, next);
+                Clock::time_point advanced = Clock::now();
+                deleteTree(root);
+                root = trainWindow(window, features, options, &leafCounts);
+                clog << "Window of rows " << max(next - windowRows, 0L) << " to " << next << ": updated in "
+                     << chrono::duration<double>(advanced - start).count() << " s, trained in "
+                     << chrono::duration<double>(Clock::now() - advanced).count() << " s" << endl;
+                end = next;
+            }
+            binMapper = window.store.binMapper;
+        } else if (windowRows > 0) {
+            cerr << "Sliding windows need the raw values, which pipelined or memory-limited loading drops" << endl;
+            return 1;
+        } else {
+            root = trainTree(store, features, options, &binMapper, &leafCounts);
+        }
+        if ((scoreScaling || prefetchBench || quantize) && store.columns.empty()) {
+            cerr << "Benchmarks and quantization need the dense columns, which sparse, pipelined or memory-limited loading drops" << endl;
+        } else {
+            if (scoreScaling) reportInferenceScaling(root, store, clog);
+            if (prefetchBench) reportPrefetchEffect(root, store, features, options, clog);
+            if (quantize && !reportQuantizedTree<uint8_t>(root, store, clog)) reportQuantizedTree<uint16_t>(root, store, clog);
+        }
+        if (visitStats && !store.isSparse() && store.columns.empty()) {
+            cerr << "Visit statistics need the raw values, which pipelined or memory-limited loading drops" << endl;
+        } else if (visitStats) {
+            // Count the visits of the dataset's rows as if they were live traffic
+            ThreadPool pool(options.numThreads);
+            VisitCounters counters(root, pool.size());
+            classifyBatchCounted(counters, store, pool);
+            dumpVisitCounters(counters, clog);
+        }
+    } else {
+        // Prompt the user for the number of data points and features
+        long numDataPoints;
+        cout << "Enter the number of data points: ";
+        cin >> numDataPoints;
+        cout << "Enter the number of features: ";
+        cin >> numFeatures;
+
+        // Prompt the user for the dataset
+        vector<vector<double>> dataset(numDataPoints, vector<double>(numFeatures + 1, 0.0)); // +1 for the class label
+        cout << "Enter the dataset (each row should contain features followed by the class label):" << endl;
+        for (long i = 0; i < numDataPoints; ++i) {
+            cout << "Data point " << i + 1 << ": ";
+            for (int j = 0; j < numFeatures + 1; ++j) {
+                cin >> dataset[i][j];
+            }
+        }
+
+        // Prompt the user for the features available for splitting
+        vector<int> features(numFeatures);
+        cout << "Enter the features available for splitting (0-based indices): ";
+        for (int i = 0; i < numFeatures; ++i) {
+            cin >> features[i];
+        }
+
+        // Build the decision tree
+        root = trainTree(dataset, features, options, &binMapper, &leafCounts);
+    }
+    if (options.memoryLimit > 0) {
+        printMemoryReport(cerr);
+    }
+    if (!modelPath.empty() && !saveModel(modelPath, root, binMapper, leafCounts)) {
+        cerr << "Cannot save the model to " << modelPath << endl;
+        return 1;
+    }
+    if (!compactPath.empty()) {
+        vector<vector<BinnedNode>> compiled(1);
+        if (!compileBinnedTree(root, binMapper, compiled[0])) {
+            cerr << "Compact trees need a tree trained on bins (--bins N)" << endl;
+            return 1;
+        }
+        if (!saveCompactTrees(compactPath, binMapper, compiled)) {
+            cerr << "Cannot save the compact tree to " << compactPath << endl;
+            return 1;
+        }
     }
-    
-    // Build the decision tree
-    Node* root = buildTree(dataset, features);
     
     vector<double> newDataPoint(numFeatures);
     cout << "Enter the features of a new data point for classification:" << endl;